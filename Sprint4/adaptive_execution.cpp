@@ -0,0 +1,163 @@
+#include "adaptive_execution.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "concurrent_hash_map.h"
+#include "work_stealing_executor.h"
+
+using namespace std;
+
+namespace {
+
+// Every query word costs a posting lookup and an IDF computation on top of its postings
+const size_t kWordOverhead = 64;
+
+using Postings = map<int, double>;
+
+// Mirrors the scoring loop of SearchServer::FindAllDocuments on a synthetic posting list
+double RunSequential(const Postings& postings) {
+    map<int, double> document_to_relevance;
+    for (const auto& [document_id, term_freq] : postings) {
+        document_to_relevance[document_id] += term_freq * 0.5;
+    }
+    return document_to_relevance.size();
+}
+
+// grain_size 0 is the default split of the work-stealing policy
+double RunParallel(const Postings& postings, size_t grain_size) {
+    ConcurrentHashMap<int, double> document_to_relevance(postings.size());
+    const WorkStealingExecutionPolicy policy{ nullptr, grain_size };
+    ForEach(policy, postings.begin(), postings.end(), [&document_to_relevance](const auto& posting) {
+        document_to_relevance.FetchAdd(posting.first, posting.second * 0.5);
+        });
+    return document_to_relevance.BuildSortedVector(policy).size();
+}
+
+template <typename Function>
+chrono::nanoseconds MeasureBest(Function function) {
+    const int kRepetitions = 3;
+    auto best = chrono::nanoseconds::max();
+    volatile double sink = 0;
+    for (int i = 0; i < kRepetitions; ++i) {
+        const auto start = chrono::steady_clock::now();
+        sink = sink + function();
+        best = min(best, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start));
+    }
+    return best;
+}
+
+} // namespace
+
+ExecutionTuner& ExecutionTuner::Instance() {
+    static ExecutionTuner tuner;
+    return tuner;
+}
+
+// Thresholds used until the calibration is done, the sizes calibration finds on common multicore machines
+ExecutionTuner::ExecutionTuner()
+    : parallel_work_(thread::hardware_concurrency() > 1 ? 1u << 14 : numeric_limits<size_t>::max())
+    , partitioned_work_(thread::hardware_concurrency() > 1 ? 1u << 16 : numeric_limits<size_t>::max())
+    , grain_size_(2048) {
+}
+
+size_t ExecutionTuner::EstimateWork(const QueryCost& cost) {
+    return cost.postings + (cost.plus_words + cost.minus_words) * kWordOverhead;
+}
+
+ExecutionChoice ExecutionTuner::Choose(const QueryCost& cost) {
+    const size_t work = EstimateWork(cost);
+    if (work >= partitioned_work_.load(memory_order_relaxed)) {
+        partitioned_count_.fetch_add(1, memory_order_relaxed);
+        return ExecutionChoice::PARTITIONED;
+    }
+    if (work >= parallel_work_.load(memory_order_relaxed)) {
+        parallel_count_.fetch_add(1, memory_order_relaxed);
+        return ExecutionChoice::PARALLEL;
+    }
+    sequential_count_.fetch_add(1, memory_order_relaxed);
+    return ExecutionChoice::SEQUENTIAL;
+}
+
+ExecutionThresholds ExecutionTuner::GetThresholds() const {
+    return { parallel_work_.load(), partitioned_work_.load(), grain_size_.load() };
+}
+
+void ExecutionTuner::SetThresholds(const ExecutionThresholds& thresholds) {
+    calibration_claimed_ = true;
+    StoreThresholds(thresholds);
+}
+
+void ExecutionTuner::StoreThresholds(const ExecutionThresholds& thresholds) {
+    parallel_work_ = thresholds.parallel_work;
+    partitioned_work_ = thresholds.partitioned_work;
+    grain_size_ = max<size_t>(thresholds.grain_size, 1);
+}
+
+void ExecutionTuner::Calibrate() {
+    const size_t never = numeric_limits<size_t>::max();
+    if (WorkStealingExecutor::Default().GetThreadCount() <= 1) {
+        StoreThresholds({ never, never, grain_size_ });
+        return;
+    }
+
+    const size_t sizes[] = { 1u << 10, 1u << 12, 1u << 14, 1u << 16 };
+    const size_t grain_sizes[] = { 512, 2048, 8192 };
+    ExecutionThresholds thresholds{ never, never, grain_size_ };
+
+    for (const size_t size : sizes) {
+        Postings postings;
+        for (size_t i = 0; i < size; ++i) {
+            postings.emplace_hint(postings.end(), static_cast<int>(i * 3), 1.0 / (i + 1));
+        }
+
+        const auto sequential_time = MeasureBest([&postings] { return RunSequential(postings); });
+        const auto parallel_time = MeasureBest([&postings] { return RunParallel(postings, 0); });
+        auto partitioned_time = chrono::nanoseconds::max();
+        size_t best_grain_size = grain_sizes[0];
+        for (const size_t grain_size : grain_sizes) {
+            if (grain_size > size) {
+                break;
+            }
+            const auto time = MeasureBest([&postings, grain_size] { return RunParallel(postings, grain_size); });
+            if (time < partitioned_time) {
+                partitioned_time = time;
+                best_grain_size = grain_size;
+            }
+        }
+
+        if (thresholds.parallel_work == never && min(parallel_time, partitioned_time) < sequential_time) {
+            thresholds.parallel_work = size;
+        }
+        if (thresholds.partitioned_work == never && partitioned_time < min(parallel_time, sequential_time)) {
+            thresholds.partitioned_work = size;
+        }
+        if (partitioned_time != chrono::nanoseconds::max()) {
+            thresholds.grain_size = best_grain_size;
+        }
+    }
+    // Partitioned execution only pays off where parallel execution does
+    thresholds.partitioned_work = max(thresholds.partitioned_work, thresholds.parallel_work);
+    StoreThresholds(thresholds);
+}
+
+void ExecutionTuner::CalibrateOnce() {
+    // Nobody waits for the calibration: a waiting pool worker could block the tasks it forks
+    if (!calibration_claimed_.exchange(true)) {
+        Calibrate();
+    }
+}
+
+ExecutionCounters ExecutionTuner::GetCounters() const {
+    return { sequential_count_.load(), parallel_count_.load(), partitioned_count_.load() };
+}
+
+void ExecutionTuner::ResetCounters() {
+    sequential_count_ = 0;
+    parallel_count_ = 0;
+    partitioned_count_ = 0;
+}
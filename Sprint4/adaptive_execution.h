@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Execution policy tags understood by SearchServer in addition to the std::execution ones
+
+// Picks sequential, parallel or partitioned parallel execution per query from its estimated cost
+struct AdaptiveExecutionPolicy {
+};
+
+namespace search_execution {
+inline constexpr AdaptiveExecutionPolicy adaptive{};
+}
+
+enum class ExecutionChoice {
+    SEQUENTIAL,
+    PARALLEL,
+    PARTITIONED,
+};
+
+struct QueryCost {
+    // Total length of the posting lists of the plus words. Minus words are resolved while planning
+    // and only counted in minus_words
+    size_t postings = 0;
+    size_t plus_words = 0;
+    size_t minus_words = 0;
+};
+
+struct ExecutionThresholds {
+    // Estimated work from which the work-stealing pool beats sequential execution
+    size_t parallel_work = 0;
+    // Estimated work from which chunks of grain_size postings beat the default split
+    size_t partitioned_work = 0;
+    size_t grain_size = 0;
+};
+
+struct ExecutionCounters {
+    uint64_t sequential = 0;
+    uint64_t parallel = 0;
+    uint64_t partitioned = 0;
+};
+
+// Process-wide choice of execution strategy. The tuner starts with fixed default thresholds,
+// CalibrateOnce replaces them with ones measured by a short microbenchmark
+class ExecutionTuner {
+public:
+    // Only constructs the tuner, never runs work on the pool
+    static ExecutionTuner& Instance();
+
+    ExecutionChoice Choose(const QueryCost& cost);
+
+    ExecutionThresholds GetThresholds() const;
+    // Explicit thresholds are kept, a later CalibrateOnce does not replace them
+    void SetThresholds(const ExecutionThresholds& thresholds);
+    // Reruns the microbenchmark, takes a few tens of milliseconds. Forks onto the default
+    // work-stealing pool, so call it from a thread outside the pool
+    void Calibrate();
+    // Startup hook, call it from a thread outside the pool once the process may start threads.
+    // The first call calibrates, later and concurrent calls return at once and queries keep the
+    // current thresholds meanwhile
+    void CalibrateOnce();
+
+    ExecutionCounters GetCounters() const;
+    void ResetCounters();
+
+private:
+    ExecutionTuner();
+
+    static size_t EstimateWork(const QueryCost& cost);
+    void StoreThresholds(const ExecutionThresholds& thresholds);
+
+    std::atomic<size_t> parallel_work_;
+    std::atomic<size_t> partitioned_work_;
+    std::atomic<size_t> grain_size_;
+    std::atomic<bool> calibration_claimed_{ false };
+    std::atomic<uint64_t> sequential_count_{ 0 };
+    std::atomic<uint64_t> parallel_count_{ 0 };
+    std::atomic<uint64_t> partitioned_count_{ 0 };
+};
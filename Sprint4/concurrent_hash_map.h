@@ -0,0 +1,349 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CONCURRENT_HASH_X86 1
+#include <immintrin.h>
+#endif
+
+#include "work_stealing_executor.h"
+
+namespace concurrent_hash_detail {
+
+// Fibonacci hashing spreads consecutive document ids over the whole table
+template <typename Key>
+size_t HashSlot(Key key, int shift) {
+    return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+inline size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+inline int Log2(size_t power_of_two) {
+    int result = 0;
+    while ((size_t(1) << result) < power_of_two) {
+        ++result;
+    }
+    return result;
+}
+
+// Tells the core it is spinning, so a sibling hyperthread runs meanwhile and the loop exit does not stall
+inline void SpinPause() {
+#if defined(CONCURRENT_HASH_X86)
+    _mm_pause();
+#endif
+}
+
+// Key of a slot. A state byte tells whether the slot is taken or erased, so every key value can be stored.
+// An insert claims the empty slot with a CAS on the state, writes the key and publishes it;
+// a probe that meets a claimed slot blocks until the key is published. That takes a few instructions,
+// unless the inserting thread is preempted in between: then the probe yields until it is scheduled again
+template <typename Key>
+class SlotKey {
+public:
+    bool IsEmpty() const {
+        return state_.load(std::memory_order_acquire) == EMPTY;
+    }
+
+    // Takes the slot for the key if it is empty
+    bool TryClaim(Key key) {
+        std::uint8_t expected = EMPTY;
+        if (!state_.compare_exchange_strong(expected, CLAIMED, std::memory_order_acquire)) {
+            return false;
+        }
+        key_ = key;
+        state_.store(FULL, std::memory_order_release);
+        return true;
+    }
+
+    // Key of a slot that is not empty
+    Key WaitForKey() const {
+        for (int spins = 0; state_.load(std::memory_order_acquire) == CLAIMED; ++spins) {
+            if (spins < kSpinsBeforeYield) {
+                SpinPause();
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+        return key_;
+    }
+
+    // The key stays in the slot, so probes still pass over it
+    void Erase() {
+        state_.store(ERASED, std::memory_order_release);
+    }
+
+    bool IsErased() const {
+        return state_.load(std::memory_order_relaxed) == ERASED;
+    }
+
+    // The key of a slot that is neither empty nor erased. Only for scans that do not run concurrently with inserts
+    std::optional<Key> Get() const {
+        if (state_.load(std::memory_order_acquire) != FULL) {
+            return std::nullopt;
+        }
+        return key_;
+    }
+
+private:
+    static constexpr int kSpinsBeforeYield = 64;
+
+    enum : std::uint8_t {
+        EMPTY,
+        CLAIMED,
+        FULL,
+        ERASED,
+    };
+
+    std::atomic<std::uint8_t> state_{ EMPTY };
+    Key key_{};
+};
+
+template <typename Value>
+void AtomicAdd(std::atomic<Value>& target, Value delta) {
+    if constexpr (std::is_integral_v<Value>) {
+        target.fetch_add(delta, std::memory_order_relaxed);
+    }
+    else {
+        Value expected = target.load(std::memory_order_relaxed);
+        while (!target.compare_exchange_weak(expected, expected + delta, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+// Walks the table in blocks with the given policy and concatenates what collect() returns per block
+template <typename Result, typename ExecutionPolicy, typename Collect>
+std::vector<Result> ParallelCollect(ExecutionPolicy&& policy, size_t slot_count, Collect collect) {
+    constexpr size_t kBlockSize = 4096;
+    const size_t block_count = (slot_count + kBlockSize - 1) / kBlockSize;
+    std::vector<std::vector<Result>> parts(block_count);
+    const auto collect_block = [&parts, &collect, slot_count](size_t block) {
+        parts[block] = collect(block * kBlockSize, std::min(slot_count, (block + 1) * kBlockSize));
+    };
+    if constexpr (kIsWorkStealingPolicy<ExecutionPolicy>) {
+        ParallelFor(AsWorkStealingPolicy(policy).GetExecutor(), 0, block_count, 1, [&collect_block](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; ++block) {
+                collect_block(block);
+            }
+            });
+    }
+    else {
+        std::for_each(std::forward<ExecutionPolicy>(policy), parts.begin(), parts.end(), [&parts, &collect_block](const auto& part) {
+            collect_block(static_cast<size_t>(&part - parts.data()));
+            });
+    }
+
+    size_t total = 0;
+    for (const auto& part : parts) {
+        total += part.size();
+    }
+    std::vector<Result> result;
+    result.reserve(total);
+    for (auto& part : parts) {
+        result.insert(result.end(), part.begin(), part.end());
+    }
+    return result;
+}
+
+} // namespace concurrent_hash_detail
+
+// Open-addressing hash map with linear probing for integer keys and arithmetic values.
+// Inserts claim a slot with a CAS on its state byte, values are updated in place with atomic
+// adds, nothing takes a lock. It is not lock-free though: a probe that reaches a slot claimed by
+// another insert waits for its key, see SlotKey. The table does not grow: it is sized for an upper bound
+// of the number of keys on construction. Every Key value can be stored.
+template <typename Key, typename Value>
+class ConcurrentHashMap {
+public:
+    static_assert(std::is_integral_v<Key>, "ConcurrentHashMap supports only integer keys");
+    static_assert(std::is_arithmetic_v<Value>, "ConcurrentHashMap supports only arithmetic values");
+
+    explicit ConcurrentHashMap(size_t max_size)
+        : capacity_(concurrent_hash_detail::RoundUpToPowerOfTwo(std::max<size_t>(max_size * 2, kSlotsPerLine)))
+        , shift_(64 - concurrent_hash_detail::Log2(capacity_))
+        , lines_(std::make_unique<CacheLine[]>(capacity_ / kSlotsPerLine)) {
+    }
+
+    // Adds delta to the value of the key, inserting the key with a zero value first if needed
+    void FetchAdd(Key key, Value delta) {
+        Slot* slot = FindOrInsert(key);
+        if (!slot->key.IsErased()) {
+            concurrent_hash_detail::AtomicAdd(slot->value, delta);
+        }
+    }
+
+    // Marks a present key as removed; later FetchAdd calls for it are ignored
+    void Erase(Key key) {
+        if (Slot* slot = FindSlot(key)) {
+            slot->key.Erase();
+        }
+    }
+
+    std::optional<Value> Find(Key key) const {
+        const Slot* slot = FindSlot(key);
+        if (slot == nullptr || slot->key.IsErased()) {
+            return std::nullopt;
+        }
+        return slot->value.load(std::memory_order_relaxed);
+    }
+
+    size_t GetCapacity() const {
+        return capacity_;
+    }
+
+    // Collects the live entries sorted by key, scanning and sorting with the given policy.
+    // Must not run concurrently with writers
+    template <typename ExecutionPolicy>
+    std::vector<std::pair<Key, Value>> BuildSortedVector(ExecutionPolicy&& policy) const {
+        auto entries = concurrent_hash_detail::ParallelCollect<std::pair<Key, Value>>(policy, capacity_, [this](size_t begin, size_t end) {
+            std::vector<std::pair<Key, Value>> part;
+            for (size_t i = begin; i < end; ++i) {
+                const Slot& slot = GetSlot(i);
+                if (const auto key = slot.key.Get()) {
+                    part.emplace_back(*key, slot.value.load(std::memory_order_relaxed));
+                }
+            }
+            return part;
+            });
+        Sort(std::forward<ExecutionPolicy>(policy), entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first < rhs.first;
+            });
+        return entries;
+    }
+
+private:
+    struct Slot {
+        concurrent_hash_detail::SlotKey<Key> key;
+        std::atomic<Value> value{ Value() };
+    };
+
+    static constexpr size_t kSlotsPerLine = std::max<size_t>(1, 64 / sizeof(Slot));
+
+    // Probing walks consecutive slots, so a probe sequence touches as few cache lines as possible
+    struct alignas(64) CacheLine {
+        Slot slots[kSlotsPerLine];
+    };
+
+    size_t capacity_;
+    int shift_;
+    std::unique_ptr<CacheLine[]> lines_;
+
+    Slot& GetSlot(size_t index) const {
+        return lines_[index / kSlotsPerLine].slots[index % kSlotsPerLine];
+    }
+
+    Slot* FindOrInsert(Key key) {
+        size_t index = concurrent_hash_detail::HashSlot(key, shift_);
+        for (size_t probe = 0; probe < capacity_; ++probe, index = (index + 1) & (capacity_ - 1)) {
+            Slot& slot = GetSlot(index);
+            if (slot.key.TryClaim(key) || slot.key.WaitForKey() == key) {
+                return &slot;
+            }
+        }
+        throw std::overflow_error("ConcurrentHashMap is full");
+    }
+
+    Slot* FindSlot(Key key) const {
+        size_t index = concurrent_hash_detail::HashSlot(key, shift_);
+        for (size_t probe = 0; probe < capacity_; ++probe, index = (index + 1) & (capacity_ - 1)) {
+            Slot& slot = GetSlot(index);
+            if (slot.key.IsEmpty()) {
+                return nullptr;
+            }
+            if (slot.key.WaitForKey() == key) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Set of integers with the same layout and probing rules as ConcurrentHashMap
+template <typename Key>
+class ConcurrentHashSet {
+public:
+    static_assert(std::is_integral_v<Key>, "ConcurrentHashSet supports only integer keys");
+
+    explicit ConcurrentHashSet(size_t max_size)
+        : capacity_(concurrent_hash_detail::RoundUpToPowerOfTwo(std::max<size_t>(max_size * 2, kSlotsPerLine)))
+        , shift_(64 - concurrent_hash_detail::Log2(capacity_))
+        , lines_(std::make_unique<CacheLine[]>(capacity_ / kSlotsPerLine)) {
+    }
+
+    // Returns true if the key was not in the set yet
+    bool Insert(Key key) {
+        size_t index = concurrent_hash_detail::HashSlot(key, shift_);
+        for (size_t probe = 0; probe < capacity_; ++probe, index = (index + 1) & (capacity_ - 1)) {
+            Slot& slot = GetSlot(index);
+            if (slot.TryClaim(key)) {
+                return true;
+            }
+            if (slot.WaitForKey() == key) {
+                return false;
+            }
+        }
+        throw std::overflow_error("ConcurrentHashSet is full");
+    }
+
+    bool Contains(Key key) const {
+        size_t index = concurrent_hash_detail::HashSlot(key, shift_);
+        for (size_t probe = 0; probe < capacity_; ++probe, index = (index + 1) & (capacity_ - 1)) {
+            const Slot& slot = GetSlot(index);
+            if (slot.IsEmpty()) {
+                return false;
+            }
+            if (slot.WaitForKey() == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Collects the keys sorted, scanning and sorting with the given policy. Must not run concurrently with Insert
+    template <typename ExecutionPolicy>
+    std::vector<Key> BuildSortedVector(ExecutionPolicy&& policy) const {
+        auto keys = concurrent_hash_detail::ParallelCollect<Key>(policy, capacity_, [this](size_t begin, size_t end) {
+            std::vector<Key> part;
+            for (size_t i = begin; i < end; ++i) {
+                if (const auto key = GetSlot(i).Get()) {
+                    part.push_back(*key);
+                }
+            }
+            return part;
+            });
+        Sort(std::forward<ExecutionPolicy>(policy), keys.begin(), keys.end(), std::less<Key>());
+        return keys;
+    }
+
+private:
+    using Slot = concurrent_hash_detail::SlotKey<Key>;
+
+    static constexpr size_t kSlotsPerLine = std::max<size_t>(1, 64 / sizeof(Slot));
+
+    struct alignas(64) CacheLine {
+        Slot slots[kSlotsPerLine];
+    };
+
+    size_t capacity_;
+    int shift_;
+    std::unique_ptr<CacheLine[]> lines_;
+
+    Slot& GetSlot(size_t index) const {
+        return lines_[index / kSlotsPerLine].slots[index % kSlotsPerLine];
+    }
+};
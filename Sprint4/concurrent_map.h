@@ -1,5 +1,9 @@
 #pragma once
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <set>
 #include <vector>
 
 template <typename Key, typename Value>
@@ -59,7 +63,8 @@ public:
     }
 
     void Insert(const T& value) {
-        int cur_set = rand() % num_sets_;
+        // Equal values must land in the same bucket, otherwise the set keeps duplicates
+        int cur_set = static_cast<int>(std::hash<T>{}(value) % num_sets_);
         std::lock_guard<std::mutex> guard(buckets_[cur_set].mutex);
         buckets_[cur_set].set.insert(value);        
     }
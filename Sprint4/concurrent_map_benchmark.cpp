@@ -0,0 +1,103 @@
+#include "concurrent_map_benchmark.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_hash_map.h"
+#include "concurrent_map.h"
+#include "log_duration.h"
+
+using namespace std;
+
+namespace {
+
+const size_t kOperationsPerThread = 1 << 18;
+
+// Cheap per-thread key stream, so the generator itself does not contend
+int NextKey(uint32_t& state, int key_space) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return static_cast<int>(state % static_cast<uint32_t>(key_space));
+}
+
+template <typename Operation>
+void RunThreads(size_t thread_count, Operation operation) {
+    vector<thread> threads;
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back([i, &operation] {
+            uint32_t state = static_cast<uint32_t>(i * 7919 + 1);
+            for (size_t k = 0; k < kOperationsPerThread; ++k) {
+                operation(state);
+            }
+            });
+    }
+    for (auto& worker : threads) {
+        worker.join();
+    }
+}
+
+void BenchmarkKeySpace(size_t thread_count, int key_space) {
+    const string suffix = ", " + to_string(thread_count) + " threads, " + to_string(key_space) + " keys";
+    // Every container must end up with the same keys
+    size_t keys_seen[4] = {};
+
+    {
+        ConcurrentMap<int, double> map(16);
+        {
+            LOG_DURATION("ConcurrentMap add" + suffix);
+            RunThreads(thread_count, [&map, key_space](uint32_t& state) {
+                map[NextKey(state, key_space)].ref_to_value += 1.0;
+                });
+        }
+        LOG_DURATION("ConcurrentMap drain" + suffix);
+        keys_seen[0] = map.BuildOrdinaryMap().size();
+    }
+    {
+        ConcurrentHashMap<int, double> map(key_space);
+        {
+            LOG_DURATION("ConcurrentHashMap add" + suffix);
+            RunThreads(thread_count, [&map, key_space](uint32_t& state) {
+                map.FetchAdd(NextKey(state, key_space), 1.0);
+                });
+        }
+        LOG_DURATION("ConcurrentHashMap drain" + suffix);
+        keys_seen[1] = map.BuildSortedVector(search_execution::work_stealing).size();
+    }
+    {
+        ConcurrentSet<int> set(16);
+        {
+            LOG_DURATION("ConcurrentSet insert" + suffix);
+            RunThreads(thread_count, [&set, key_space](uint32_t& state) {
+                set.Insert(NextKey(state, key_space));
+                });
+        }
+        LOG_DURATION("ConcurrentSet drain" + suffix);
+        keys_seen[2] = set.BuildOrdinarySet().size();
+    }
+    {
+        ConcurrentHashSet<int> set(key_space);
+        {
+            LOG_DURATION("ConcurrentHashSet insert" + suffix);
+            RunThreads(thread_count, [&set, key_space](uint32_t& state) {
+                set.Insert(NextKey(state, key_space));
+                });
+        }
+        LOG_DURATION("ConcurrentHashSet drain" + suffix);
+        keys_seen[3] = set.BuildSortedVector(search_execution::work_stealing).size();
+    }
+    cout << "distinct keys seen: ConcurrentMap " << keys_seen[0] << ", ConcurrentHashMap " << keys_seen[1]
+        << ", ConcurrentSet " << keys_seen[2] << ", ConcurrentHashSet " << keys_seen[3] << endl;
+}
+
+} // namespace
+
+void BenchmarkConcurrentMaps() {
+    const size_t thread_count = max(4u, thread::hardware_concurrency());
+    BenchmarkKeySpace(thread_count, 64);
+    BenchmarkKeySpace(thread_count, 1 << 16);
+}
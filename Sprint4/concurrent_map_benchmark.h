@@ -0,0 +1,6 @@
+#pragma once
+
+// Contention microbenchmark of ConcurrentMap/ConcurrentSet against ConcurrentHashMap/ConcurrentHashSet:
+// every thread hammers a shared container with updates over a small (hot) and a large key space,
+// then the container is drained into an ordinary sorted container
+void BenchmarkConcurrentMaps();
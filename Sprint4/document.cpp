@@ -1,3 +1,5 @@
+#include <cmath>
+
 #include "document.h"
 
 std::ostream& operator<<(std::ostream& out, const Document& document) {
@@ -9,6 +11,20 @@ std::ostream& operator<<(std::ostream& out, const Document& document) {
     return out;
 }
 
+bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (std::abs(lhs.relevance - rhs.relevance) < 1e-6) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+bool HasHigherRank(const Document& lhs, const Document& rhs) {
+    if (std::abs(lhs.relevance - rhs.relevance) < 1e-6 && lhs.rating == rhs.rating) {
+        return lhs.id < rhs.id;
+    }
+    return IsMoreRelevant(lhs, rhs);
+}
+
 void PrintDocument(const Document& document) {
     std::cout << "{ "
         << "document_id = " << document.id << ", "
@@ -20,6 +20,11 @@ struct Document {
 
 std::ostream& operator<<(std::ostream& out, const Document& document);
 
+// Ranking order of search results: relevance first, rating breaks ties
+bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+// Ranking order of FindTopDocuments: IsMoreRelevant, the lower id breaks the remaining ties
+bool HasHigherRank(const Document& lhs, const Document& rhs);
+
 enum class DocumentStatus {
     ACTUAL,
     IRRELEVANT,
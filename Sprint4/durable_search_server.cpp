@@ -0,0 +1,277 @@
+#include "durable_search_server.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const string kSnapshotPrefix = "snapshot-";
+const string kSnapshotSuffix = ".bin";
+const string kSegmentPrefix = "mutations-";
+const string kSegmentSuffix = ".log";
+const size_t kSequenceDigits = 20;
+
+// Sequence numbers are zero-padded, so that the names sort in sequence order
+string MakeFilePath(const string& directory, const string& prefix, uint64_t sequence, const string& suffix) {
+    const string number = to_string(sequence);
+    const string name = prefix + string(kSequenceDigits - number.size(), '0') + number + suffix;
+    return (filesystem::path(directory) / name).string();
+}
+
+optional<uint64_t> ParseFileName(const string& name, const string& prefix, const string& suffix) {
+    if (name.size() != prefix.size() + kSequenceDigits + suffix.size()
+        || name.compare(0, prefix.size(), prefix) != 0
+        || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return nullopt;
+    }
+    const string number = name.substr(prefix.size(), kSequenceDigits);
+    if (!all_of(number.begin(), number.end(), [](char c) {
+        return c >= '0' && c <= '9';
+        })) {
+        return nullopt;
+    }
+    return stoull(number);
+}
+
+// Sequence numbers of the files with the prefix and the suffix, in increasing order
+vector<uint64_t> ListFiles(const string& directory, const string& prefix, const string& suffix) {
+    vector<uint64_t> sequences;
+    for (const auto& entry : filesystem::directory_iterator(directory)) {
+        if (const auto sequence = ParseFileName(entry.path().filename().string(), prefix, suffix)) {
+            sequences.push_back(*sequence);
+        }
+    }
+    sort(sequences.begin(), sequences.end());
+    return sequences;
+}
+
+void ApplyMutation(SearchServer& search_server, const IndexMutation& mutation) {
+    if (mutation.type == IndexMutation::Type::ADD) {
+        search_server.AddDocument(mutation.document_id, mutation.document, mutation.status, mutation.ratings);
+    }
+    else {
+        search_server.RemoveDocument(mutation.document_id);
+    }
+}
+
+} // namespace
+
+DurableSearchServer::DurableSearchServer(string directory, const string& stop_words_text, DurableSearchServerOptions options)
+    : directory_(move(directory))
+    , options_(options)
+    , search_server_(stop_words_text, options.memory_mode, options.posting_order) {
+    filesystem::create_directories(directory_);
+    Recover();
+}
+
+void DurableSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    unique_lock<mutex> lock(mutex_);
+    WaitForDocument(lock, document_id);
+    // Only mutations the index accepts are logged, so applying one after its fsync can fail only for lack of memory
+    search_server_.CheckNewDocument(document_id, document);
+    IndexMutation mutation;
+    mutation.type = IndexMutation::Type::ADD;
+    mutation.document_id = document_id;
+    mutation.document = string(document);
+    mutation.status = status;
+    mutation.ratings = ratings;
+    Commit(lock, mutation);
+}
+
+void DurableSearchServer::RemoveDocument(int document_id) {
+    unique_lock<mutex> lock(mutex_);
+    WaitForDocument(lock, document_id);
+    if (!search_server_.HasDocument(document_id)) {
+        return;
+    }
+    IndexMutation mutation;
+    mutation.type = IndexMutation::Type::REMOVE;
+    mutation.document_id = document_id;
+    Commit(lock, mutation);
+}
+
+void DurableSearchServer::Checkpoint() {
+    unique_lock<mutex> lock(mutex_);
+    mutation_applied_.wait(lock, [this] {
+        return !writing_snapshot_;
+        });
+    CheckIndex();
+    WriteSnapshot(lock);
+    CheckIndex();
+}
+
+const SearchServer& DurableSearchServer::GetSearchServer() const {
+    return search_server_;
+}
+
+RecoveryStats DurableSearchServer::GetRecoveryStats() const {
+    return recovery_stats_;
+}
+
+MutationLogStats DurableSearchServer::GetLogStats() const {
+    lock_guard<mutex> guard(mutex_);
+    MutationLogStats stats = log_->GetStats();
+    stats.records += closed_segments_stats_.records;
+    stats.syncs += closed_segments_stats_.syncs;
+    return stats;
+}
+
+void DurableSearchServer::Recover() {
+    const auto snapshots = ListFiles(directory_, kSnapshotPrefix, kSnapshotSuffix);
+    if (!snapshots.empty()) {
+        snapshot_sequence_ = snapshots.back();
+        const string path = MakeFilePath(directory_, kSnapshotPrefix, snapshot_sequence_, kSnapshotSuffix);
+        ifstream in(path, ios::binary);
+        if (!in) {
+            throw runtime_error("Failed to open " + path);
+        }
+        search_server_.LoadSnapshot(in);
+    }
+    recovery_stats_.snapshot_sequence = snapshot_sequence_;
+    recovery_stats_.snapshot_documents = search_server_.GetDocumentCount();
+
+    // Segments replaced by the snapshot are still there if the process stopped before deleting them
+    const auto segments = ListFiles(directory_, kSegmentPrefix, kSegmentSuffix);
+    uint64_t next_sequence = snapshot_sequence_ + 1;
+    size_t last_segment_size = 0;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        // The snapshot covers every record of a segment followed by one that starts right after the snapshot
+        // or earlier. Such a segment may still end with a torn record: its log failed and the snapshot gave a fresh start
+        if (i + 1 < segments.size() && segments[i + 1] <= snapshot_sequence_ + 1) {
+            continue;
+        }
+        const string path = MakeFilePath(directory_, kSegmentPrefix, segments[i], kSegmentSuffix);
+        const size_t valid_size = ReadMutationLog(path, [&](uint64_t sequence, IndexMutation mutation) {
+            if (sequence < next_sequence) {
+                return;
+            }
+            if (sequence != next_sequence) {
+                throw runtime_error("Mutation " + to_string(next_sequence) + " is missing from the log");
+            }
+            ApplyMutation(search_server_, mutation);
+            ++next_sequence;
+            ++recovery_stats_.replayed_mutations;
+            });
+        const size_t file_size = filesystem::file_size(path);
+        // Only the segment being written at the time of a crash can end with a torn record
+        if (valid_size < file_size && i + 1 < segments.size()) {
+            throw runtime_error("Mutation log segment " + path + " is corrupt");
+        }
+        recovery_stats_.discarded_bytes = file_size - valid_size;
+        last_segment_size = valid_size;
+    }
+
+    const uint64_t segment = segments.empty() ? next_sequence : segments.back();
+    log_ = make_shared<MutationLog>(MakeFilePath(directory_, kSegmentPrefix, segment, kSegmentSuffix), last_segment_size, next_sequence);
+}
+
+void DurableSearchServer::WaitForDocument(unique_lock<mutex>& lock, int document_id) {
+    mutation_applied_.wait(lock, [this, document_id] {
+        return !writing_snapshot_ && pending_documents_.count(document_id) == 0;
+        });
+    CheckIndex();
+}
+
+void DurableSearchServer::CheckIndex() const {
+    if (!index_error_.empty()) {
+        throw runtime_error(index_error_);
+    }
+}
+
+void DurableSearchServer::Commit(unique_lock<mutex>& lock, const IndexMutation& mutation) {
+    const uint64_t sequence = log_->Append(mutation);
+    pending_documents_.insert(mutation.document_id);
+    // Other mutations proceed while this one waits, and join its fsync or the next one.
+    // Mutations of different documents commute, so they may be applied in any order
+    const shared_ptr<MutationLog> log = log_;
+    lock.unlock();
+    try {
+        log->Sync(sequence);
+    }
+    catch (...) {
+        // The record may or may not be on disk, the caller gets the error as for a crash during the call.
+        // The log refuses every later record, and the next snapshot skips this one
+        lock.lock();
+        pending_documents_.erase(mutation.document_id);
+        mutation_applied_.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    try {
+        ApplyMutation(search_server_, mutation);
+    }
+    catch (const exception& e) {
+        // The record is on disk and replays fine, but the index may hold part of the mutation.
+        // Nothing more is logged or snapshotted, reopening the directory rebuilds the index from the files
+        index_error_ = "Mutation " + to_string(sequence) + " is logged but not applied (" + e.what()
+            + "), reopen the directory to recover it";
+        pending_documents_.erase(mutation.document_id);
+        mutation_applied_.notify_all();
+        throw;
+    }
+    pending_documents_.erase(mutation.document_id);
+    mutation_applied_.notify_all();
+
+    if (options_.snapshot_interval > 0 && !writing_snapshot_ && index_error_.empty()
+        && sequence >= snapshot_sequence_ + options_.snapshot_interval) {
+        WriteSnapshot(lock);
+    }
+}
+
+void DurableSearchServer::WriteSnapshot(unique_lock<mutex>& lock) {
+    // The snapshot covers every logged mutation, so the pending ones have to be in the index first
+    writing_snapshot_ = true;
+    try {
+        mutation_applied_.wait(lock, [this] {
+            return pending_documents_.empty();
+            });
+        if (index_error_.empty()) {
+            WriteSnapshotFiles();
+        }
+    }
+    catch (...) {
+        writing_snapshot_ = false;
+        mutation_applied_.notify_all();
+        throw;
+    }
+    writing_snapshot_ = false;
+    mutation_applied_.notify_all();
+}
+
+// Runs with no mutation pending: every logged mutation is in the index, except the ones whose write failed.
+// Their sequence numbers are skipped by the snapshot, and the new segment gives a failed log a fresh start
+void DurableSearchServer::WriteSnapshotFiles() {
+    const uint64_t sequence = log_->GetLastSequence();
+    if (sequence == snapshot_sequence_) {
+        return;
+    }
+
+    ostringstream snapshot;
+    search_server_.SaveSnapshot(snapshot);
+    WriteFileDurably(MakeFilePath(directory_, kSnapshotPrefix, sequence, kSnapshotSuffix), snapshot.str());
+
+    const MutationLogStats stats = log_->GetStats();
+    closed_segments_stats_.records += stats.records;
+    closed_segments_stats_.syncs += stats.syncs;
+    log_ = make_shared<MutationLog>(MakeFilePath(directory_, kSegmentPrefix, sequence + 1, kSegmentSuffix), 0, sequence + 1);
+    snapshot_sequence_ = sequence;
+
+    // A crash from here on leaves files that the next recovery skips
+    for (const uint64_t old_sequence : ListFiles(directory_, kSnapshotPrefix, kSnapshotSuffix)) {
+        if (old_sequence < sequence) {
+            filesystem::remove(MakeFilePath(directory_, kSnapshotPrefix, old_sequence, kSnapshotSuffix));
+        }
+    }
+    for (const uint64_t old_sequence : ListFiles(directory_, kSegmentPrefix, kSegmentSuffix)) {
+        if (old_sequence <= sequence) {
+            filesystem::remove(MakeFilePath(directory_, kSegmentPrefix, old_sequence, kSegmentSuffix));
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mutation_log.h"
+#include "search_server.h"
+
+struct DurableSearchServerOptions {
+    IndexMemoryMode memory_mode = IndexMemoryMode::HEAP;
+    // A snapshot is taken after this many mutations, 0 takes them only on Checkpoint
+    uint64_t snapshot_interval = 100'000;
+    PostingOrder posting_order = PostingOrder::BY_ID;
+};
+
+struct RecoveryStats {
+    // Last mutation contained in the loaded snapshot, 0 without one
+    uint64_t snapshot_sequence = 0;
+    int snapshot_documents = 0;
+    uint64_t replayed_mutations = 0;
+    // Size of the torn record cut off the end of the log
+    size_t discarded_bytes = 0;
+};
+
+// POSIX only: search server whose documents survive a restart or a crash.
+// AddDocument and RemoveDocument validate the mutation, wait until it is fsynced to the log and only
+// then apply it to the index, so the index never holds a mutation the log could lose. Concurrent
+// callers share fsyncs, mutations of the same document wait for each other. The directory holds the
+// newest snapshot, snapshot-N.bin with the index after mutation N, and the log segments after it,
+// mutations-M.log starting with mutation M. Opening the directory loads the snapshot and replays the
+// log, so it takes time proportional to the writes since the last snapshot rather than to the corpus
+class DurableSearchServer {
+public:
+    // The stop words must be the same every time the directory is opened
+    DurableSearchServer(std::string directory, const std::string& stop_words_text, DurableSearchServerOptions options = {});
+
+    // Throw std::invalid_argument before logging anything if the index would reject the mutation. If a logged
+    // mutation cannot be applied, these and Checkpoint throw std::runtime_error until the directory is reopened
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void RemoveDocument(int document_id);
+
+    // Writes a snapshot of the index and deletes the snapshots and log segments it replaces.
+    // Mutations wait while the snapshot is written
+    void Checkpoint();
+
+    // Reads are not synchronized with AddDocument and RemoveDocument, as for SearchServer itself
+    const SearchServer& GetSearchServer() const;
+    RecoveryStats GetRecoveryStats() const;
+    // Records and fsyncs of the log since the directory was opened
+    MutationLogStats GetLogStats() const;
+
+private:
+    const std::string directory_;
+    const DurableSearchServerOptions options_;
+    SearchServer search_server_;
+    RecoveryStats recovery_stats_;
+    mutable std::mutex mutex_;
+    std::condition_variable mutation_applied_;
+    std::shared_ptr<MutationLog> log_;
+    // Documents of the mutations that are logged but wait for their fsync, not applied yet
+    std::set<int> pending_documents_;
+    // Holds back new mutations until the pending ones are applied and the snapshot is written
+    bool writing_snapshot_ = false;
+    // Set when a logged mutation could not be applied: the index no longer matches the log
+    std::string index_error_;
+    uint64_t snapshot_sequence_ = 0;
+    MutationLogStats closed_segments_stats_;
+
+    void Recover();
+    // Waits for a snapshot being written and for the pending mutation of the document
+    void WaitForDocument(std::unique_lock<std::mutex>& lock, int document_id);
+    // Throws std::runtime_error once the index no longer matches the log
+    void CheckIndex() const;
+    // Logs the mutation, waits for its fsync and applies it to the index
+    void Commit(std::unique_lock<std::mutex>& lock, const IndexMutation& mutation);
+    void WriteSnapshot(std::unique_lock<std::mutex>& lock);
+    void WriteSnapshotFiles();
+};
@@ -0,0 +1,229 @@
+#include "local_socket.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+runtime_error SystemError(const string& what) {
+    return runtime_error(what + ": " + strerror(errno));
+}
+
+sockaddr_un MakeUnixAddress(const string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw invalid_argument("Unix socket path is too long: " + path);
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+sockaddr_in MakeLoopbackAddress(int port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+// Connects without blocking past the deadline: a worker that does not accept must not stall the router
+void ConnectBefore(const Socket& connection, const sockaddr* address, socklen_t length,
+    chrono::steady_clock::time_point deadline, const string& what) {
+    SetNonBlocking(connection);
+    while (connect(connection.Get(), address, length) != 0) {
+        if (errno == EISCONN) {
+            return;
+        }
+        // A Unix socket with a full backlog fails with EAGAIN instead of connecting in the background
+        const bool backlog_full = errno == EAGAIN;
+        if (!backlog_full && errno != EINPROGRESS && errno != EALREADY && errno != EINTR) {
+            throw SystemError(what);
+        }
+        const auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            errno = ETIMEDOUT;
+            throw SystemError(what);
+        }
+        if (backlog_full) {
+            this_thread::sleep_for(min(left, chrono::milliseconds(1)));
+            continue;
+        }
+        pollfd descriptor{ connection.Get(), POLLOUT, 0 };
+        if (poll(&descriptor, 1, static_cast<int>(left.count())) <= 0) {
+            continue;
+        }
+        int error = 0;
+        socklen_t error_length = sizeof(error);
+        if (getsockopt(connection.Get(), SOL_SOCKET, SO_ERROR, &error, &error_length) != 0) {
+            throw SystemError(what);
+        }
+        if (error != 0) {
+            errno = error;
+            throw SystemError(what);
+        }
+        return;
+    }
+}
+
+} // namespace
+
+PartitionEndpoint PartitionEndpoint::Unix(string path) {
+    PartitionEndpoint endpoint;
+    endpoint.kind = Kind::UNIX;
+    endpoint.path = move(path);
+    return endpoint;
+}
+
+PartitionEndpoint PartitionEndpoint::LoopbackTcp(int port) {
+    PartitionEndpoint endpoint;
+    endpoint.kind = Kind::TCP;
+    endpoint.port = port;
+    return endpoint;
+}
+
+ostream& operator<<(ostream& out, const PartitionEndpoint& endpoint) {
+    if (endpoint.kind == PartitionEndpoint::Kind::UNIX) {
+        return out << "unix:" << endpoint.path;
+    }
+    return out << "tcp:127.0.0.1:" << endpoint.port;
+}
+
+Socket::Socket(Socket&& other) noexcept : fd_(other.Release()) {
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept {
+    if (this != &other) {
+        Close();
+        fd_ = other.Release();
+    }
+    return *this;
+}
+
+Socket::~Socket() {
+    Close();
+}
+
+int Socket::Release() {
+    return exchange(fd_, -1);
+}
+
+void Socket::Close() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+Socket ListenOn(PartitionEndpoint& endpoint) {
+    if (endpoint.kind == PartitionEndpoint::Kind::UNIX) {
+        Socket listener(socket(AF_UNIX, SOCK_STREAM, 0));
+        if (!listener.IsOpen()) {
+            throw SystemError("socket");
+        }
+        const auto address = MakeUnixAddress(endpoint.path);
+        unlink(endpoint.path.c_str());
+        if (bind(listener.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+            throw SystemError("bind " + endpoint.path);
+        }
+        if (listen(listener.Get(), SOMAXCONN) != 0) {
+            throw SystemError("listen");
+        }
+        return listener;
+    }
+
+    Socket listener(socket(AF_INET, SOCK_STREAM, 0));
+    if (!listener.IsOpen()) {
+        throw SystemError("socket");
+    }
+    const int reuse = 1;
+    setsockopt(listener.Get(), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    auto address = MakeLoopbackAddress(endpoint.port);
+    if (bind(listener.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        throw SystemError("bind port " + to_string(endpoint.port));
+    }
+    if (listen(listener.Get(), SOMAXCONN) != 0) {
+        throw SystemError("listen");
+    }
+    socklen_t length = sizeof(address);
+    getsockname(listener.Get(), reinterpret_cast<sockaddr*>(&address), &length);
+    endpoint.port = ntohs(address.sin_port);
+    return listener;
+}
+
+Socket AcceptConnection(const Socket& listener) {
+    Socket connection(accept(listener.Get(), nullptr, nullptr));
+    if (!connection.IsOpen()) {
+        throw SystemError("accept");
+    }
+    return connection;
+}
+
+Socket ConnectTo(const PartitionEndpoint& endpoint, chrono::steady_clock::time_point deadline) {
+    if (endpoint.kind == PartitionEndpoint::Kind::UNIX) {
+        Socket connection(socket(AF_UNIX, SOCK_STREAM, 0));
+        if (!connection.IsOpen()) {
+            throw SystemError("socket");
+        }
+        const auto address = MakeUnixAddress(endpoint.path);
+        ConnectBefore(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address), deadline, "connect " + endpoint.path);
+        return connection;
+    }
+
+    Socket connection(socket(AF_INET, SOCK_STREAM, 0));
+    if (!connection.IsOpen()) {
+        throw SystemError("socket");
+    }
+    const auto address = MakeLoopbackAddress(endpoint.port);
+    ConnectBefore(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address), deadline,
+        "connect port " + to_string(endpoint.port));
+    // Requests are small and latency bound
+    const int no_delay = 1;
+    setsockopt(connection.Get(), IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    return connection;
+}
+
+void SetNonBlocking(const Socket& socket) {
+    const int flags = fcntl(socket.Get(), F_GETFL, 0);
+    fcntl(socket.Get(), F_SETFL, flags | O_NONBLOCK);
+}
+
+bool SendAll(const Socket& socket, string_view data, chrono::steady_clock::time_point deadline) {
+    while (!data.empty()) {
+        const ssize_t written = send(socket.Get(), data.data(), data.size(), MSG_NOSIGNAL);
+        if (written > 0) {
+            data.remove_prefix(static_cast<size_t>(written));
+            continue;
+        }
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            const auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                return false;
+            }
+            pollfd descriptor{ socket.Get(), POLLOUT, 0 };
+            poll(&descriptor, 1, static_cast<int>(left.count()));
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
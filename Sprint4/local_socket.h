@@ -0,0 +1,59 @@
+#pragma once
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+// POSIX only: Unix-domain and loopback TCP sockets used by the partition router and workers
+
+struct PartitionEndpoint {
+    enum class Kind {
+        UNIX,
+        TCP,
+    };
+
+    static PartitionEndpoint Unix(std::string path);
+    // Port 0 lets the system pick a free port when listening
+    static PartitionEndpoint LoopbackTcp(int port);
+
+    Kind kind = Kind::UNIX;
+    std::string path;
+    int port = 0;
+};
+
+std::ostream& operator<<(std::ostream& out, const PartitionEndpoint& endpoint);
+
+class Socket {
+public:
+    Socket() = default;
+    explicit Socket(int fd) : fd_(fd) {
+    }
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    Socket(Socket&& other) noexcept;
+    Socket& operator=(Socket&& other) noexcept;
+    ~Socket();
+
+    int Get() const {
+        return fd_;
+    }
+    bool IsOpen() const {
+        return fd_ >= 0;
+    }
+    int Release();
+    void Close();
+
+private:
+    int fd_ = -1;
+};
+
+// Binds and listens; for TCP port 0 the endpoint is updated with the chosen port
+Socket ListenOn(PartitionEndpoint& endpoint);
+Socket AcceptConnection(const Socket& listener);
+// Returns a non-blocking socket. Throws std::runtime_error on error or if the connection is not
+// established by the deadline
+Socket ConnectTo(const PartitionEndpoint& endpoint, std::chrono::steady_clock::time_point deadline);
+void SetNonBlocking(const Socket& socket);
+
+// Writes the whole buffer, waiting for the socket to drain until the deadline. Returns false on error or timeout
+bool SendAll(const Socket& socket, std::string_view data, std::chrono::steady_clock::time_point deadline);
@@ -1,9 +1,30 @@
-﻿#include <random>
+﻿#include <filesystem>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
 
+#include "concurrent_map_benchmark.h"
 #include "search_server.h"
 #include "log_duration.h"
+#include "paginated_search.h"
 #include "process_queries.h"
+#include "query_replay.h"
 #include "read_input_functions.h"
+#include "request_queue.h"
+#include "score_kernels.h"
+#ifndef _WIN32
+#include "durable_search_server.h"
+#include "partition_worker.h"
+#include "query_router.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -62,10 +83,744 @@ void Test(string mark, const SearchServer& search_server, const vector<string>&
     cout << total_relevance << endl;
 }
 
+// Relevance of two documents can move by twice the bound in opposite directions
+void ReportFrequencyPrecision(const SearchServer& search_server, const vector<string>& queries) {
+    double error_bound = 0.0;
+    for (const string_view query : queries) {
+        error_bound = max(error_bound, search_server.GetRelevanceErrorBound(query));
+    }
+    cout << "frequencies stored in " << SEARCH_SERVER_FREQUENCY_BITS << " bits, relevance error up to " << error_bound
+        << (2 * error_bound < 1e-6 ? ", rankings are stable" : ", rankings may change") << " under the 1e-6 tie tolerance" << endl;
+}
+
+template <typename ExecutionPolicy>
+void SearchWithBudget(const string& mark, const SearchServer& search_server, const string& query, const SearchBudget& budget,
+    ExecutionPolicy&& policy) {
+    LOG_DURATION(mark);
+    const SearchResult result = search_server.FindTopDocuments(policy, query, budget);
+    cout << "  " << result.evaluated_postings << " of " << result.candidate_postings << " postings scored"
+        << (result.is_partial ? ", partial" : "") << ", " << result.documents.size() << " documents" << endl;
+}
+
+// The posting limit of a batch applies to each query on its own: long queries stop early, none scores more than the limit
+void CheckBudgetedProcessQueries(const SearchServer& search_server, const vector<string>& queries) {
+    constexpr size_t kMaxPostings = 20'000;
+    const auto results = ProcessQueries(search_server, queries, SearchBudget::Postings(kMaxPostings));
+    size_t partial = 0;
+    size_t over_limit = 0;
+    size_t max_scored = 0;
+    for (const SearchResult& result : results) {
+        partial += result.is_partial ? 1 : 0;
+        over_limit += result.evaluated_postings > kMaxPostings ? 1 : 0;
+        max_scored = max(max_scored, result.evaluated_postings);
+    }
+    cout << "ProcessQueries within " << kMaxPostings << " postings per query: " << partial << " of " << results.size()
+        << " results partial, at most " << max_scored << " postings scored, " << over_limit << " over the limit" << endl;
+}
+
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
 
-int main() {
+// The largest id is a valid document id: every policy has to find the document
+void CheckLargestDocumentId() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(numeric_limits<int>::max(), "white cat", DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(1, "black dog", DocumentStatus::ACTUAL, { 1 });
+    int found = 0;
+    const auto check = [&](const auto& policy) {
+        try {
+            const auto documents = search_server.FindTopDocuments(policy, "cat");
+            found += documents.size() == 1 && documents[0].id == numeric_limits<int>::max() ? 1 : 0;
+        }
+        catch (const exception& e) {
+            cout << "search of the largest document id failed: " << e.what() << endl;
+        }
+    };
+    check(execution::seq);
+    check(execution::par);
+    check(search_execution::work_stealing);
+    check(search_execution::adaptive);
+    cout << "document with the largest id found under " << found << " of 4 policies" << endl;
+}
+
+// A pool with pinned workers: every worker runs on one core and searches on it match the sequential ones
+void CheckPinnedExecutor(const SearchServer& search_server, const vector<string>& queries) {
+    WorkStealingExecutor executor({ 2, true });
+    // Submitted tasks run on the workers only, the waiting thread does not help with them
+    vector<future<bool>> pinned(8);
+    for (auto& result : pinned) {
+        auto task = make_shared<packaged_task<bool()>>([] {
+#if defined(__linux__)
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            return pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0 && CPU_COUNT(&cpu_set) == 1;
+#else
+            return true;
+#endif
+            });
+        result = task->get_future();
+        executor.Submit([task] { (*task)(); });
+    }
+    const size_t pinned_tasks = count_if(pinned.begin(), pinned.end(), [](auto& result) { return result.get(); });
+
+    const WorkStealingExecutionPolicy policy{ &executor, 0 };
+    size_t mismatches = 0;
+    for (const string& query : queries) {
+        const auto expected = search_server.FindTopDocuments(execution::seq, query);
+        const auto documents = search_server.FindTopDocuments(policy, query);
+        mismatches += documents.size() != expected.size() || !equal(documents.begin(), documents.end(), expected.begin(),
+            [](const Document& lhs, const Document& rhs) { return lhs.id == rhs.id; }) ? 1 : 0;
+    }
+    cout << "pinned pool: " << pinned_tasks << " of " << pinned.size() << " tasks ran on a pinned worker, "
+        << mismatches << " of " << queries.size() << " queries differ from seq" << endl;
+}
+
+// First adaptive queries of the process run as pool tasks: the tuner must not fork onto the pool from under them
+void CheckColdProcessQueries() {
+    mt19937 generator(7);
+    const auto dictionary = GenerateDictionary(generator, 1000, 10);
+    SearchServer search_server(""s);
+    for (int i = 0; i < 5000; ++i) {
+        search_server.AddDocument(i, GenerateQuery(generator, dictionary, 50), DocumentStatus::ACTUAL, { 1 });
+    }
+    const auto queries = GenerateQueries(generator, dictionary, 200, 5);
+    auto result = async(launch::async, [&search_server, &queries] {
+        return ProcessQueries(search_server, queries).size();
+        });
+    const size_t thread_count = WorkStealingExecutor::Default().GetThreadCount();
+    if (result.wait_for(chrono::seconds(60)) != future_status::ready) {
+        cout << "cold ProcessQueries on " << thread_count << " workers did not finish in 60 s" << endl;
+        quick_exit(1);
+    }
+    cout << "cold ProcessQueries on " << thread_count << " workers answered " << result.get() << " of " << queries.size()
+        << " queries" << endl;
+}
+
+void PrintMemoryStats(const string& name, const MemoryResourceStats& stats) {
+    cout << "  " << name << ": " << stats.allocations << " allocations, " << stats.deallocations << " deallocations, "
+        << stats.bytes_in_use << " bytes in use, peak " << stats.peak_bytes_in_use << endl;
+}
+
+void CompareIndexMemoryModes(const string& stop_words, const vector<string>& documents, const vector<string>& queries) {
+    const pair<string, IndexMemoryMode> modes[] = {
+        { "heap", IndexMemoryMode::HEAP },
+        { "pooled", IndexMemoryMode::POOLED },
+        { "monotonic", IndexMemoryMode::MONOTONIC },
+    };
+    for (const auto& [name, mode] : modes) {
+        LOG_DURATION("index memory " + name);
+        SearchServer search_server(stop_words, mode);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        for (const string_view query : queries) {
+            search_server.FindTopDocuments(query);
+        }
+        const auto usage = search_server.MemoryUsage();
+        cout << "  estimated bytes: dictionary " << usage.dictionary << ", postings " << usage.postings
+            << ", term vectors " << usage.term_vectors << ", metadata " << usage.metadata << ", caches " << usage.caches
+            << ", allocator reserve " << usage.allocator_reserve << ", total " << usage.GetTotal() << endl;
+        const auto stats = search_server.GetMemoryStats();
+        PrintMemoryStats("index", stats.index);
+        PrintMemoryStats("index upstream", stats.index_upstream);
+        PrintMemoryStats("query scratch", stats.query_scratch);
+
+        // Only the posting arena of MONOTONIC keeps the memory of removed documents
+        const size_t churn_count = min<size_t>(documents.size(), 1'000);
+        for (size_t i = 0; i < churn_count; ++i) {
+            search_server.RemoveDocument(i);
+            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        const auto churned = search_server.GetMemoryStats().index_upstream.bytes_in_use;
+        cout << "  removing and adding " << churn_count << " documents again took "
+            << static_cast<int64_t>(churned) - static_cast<int64_t>(stats.index_upstream.bytes_in_use) << " bytes more" << endl;
+    }
+}
+
+// A moved server keeps the memory resource of the index: nothing is allocated again and searches give the same results
+void CheckServerMove(const string& stop_words, const vector<string>& documents, const vector<string>& queries) {
+    static_assert(is_nothrow_move_constructible_v<SearchServer>, "SearchServer has to be moved when a vector grows");
+    SearchServer source(stop_words, IndexMemoryMode::POOLED);
+    for (size_t i = 0; i < 1'000; ++i) {
+        source.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    // A copy would start without the deallocations of the removal
+    source.RemoveDocument(0);
+    const auto expected = source.FindTopDocuments(queries[0]);
+    const auto before = source.GetMemoryStats();
+
+    const SearchServer moved(move(source));
+    const auto after = moved.GetMemoryStats();
+    const auto found = moved.FindTopDocuments(queries[0]);
+    bool same = after.index_mode == before.index_mode
+        && after.index.allocations == before.index.allocations
+        && after.index.deallocations == before.index.deallocations
+        && after.index_upstream.allocations == before.index_upstream.allocations
+        && found.size() == expected.size();
+    for (size_t i = 0; same && i < found.size(); ++i) {
+        same = found[i].id == expected[i].id;
+    }
+    cout << "moved search server " << (same ? "keeps" : "does not keep") << " its index memory" << endl;
+}
+
+// The same short queries against postings by id only and with impact-ordered postings
+void CompareImpactOrder(const string& stop_words, const vector<string>& documents, const vector<string>& dictionary) {
+    SearchServer by_id(stop_words);
+    SearchServer by_impact(stop_words, IndexMemoryMode::HEAP, PostingOrder::BY_ID_AND_IMPACT);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        by_id.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        by_impact.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    mt19937 generator;
+    for (const int word_count : { 1, 2, 3 }) {
+        const auto queries = GenerateQueries(generator, dictionary, 10'000, word_count);
+        const string words = to_string(word_count) + (word_count == 1 ? " word" : " words");
+        Test("postings by id, " + words, by_id, queries, execution::seq);
+        Test("postings by impact, " + words, by_impact, queries, execution::seq);
+    }
+    const auto usage = by_impact.MemoryUsage();
+    cout << "  impact-ordered postings take " << usage.impact_postings << " of " << usage.GetTotal() << " bytes" << endl;
+}
+
+// Walks every query page by page and checks that the pages add up to all matched documents, each once,
+// starting with the top documents of FindTopDocuments
+void WalkSearchPages(const SearchServer& search_server, const vector<string>& queries) {
+    PaginatedSearch paginated_search(search_server, 8);
+    size_t page_count = 0;
+    size_t mismatches = 0;
+    LOG_DURATION("paginated search");
+    for (const string& query : queries) {
+        vector<Document> walked;
+        string cursor;
+        do {
+            auto page = paginated_search.FindPage(query, 20, cursor);
+            walked.insert(walked.end(), page.documents.begin(), page.documents.end());
+            cursor = move(page.next_cursor);
+            ++page_count;
+        } while (!cursor.empty());
+
+        const auto top = search_server.FindTopDocuments(query);
+        set<int> walked_ids;
+        for (const Document& document : walked) {
+            walked_ids.insert(document.id);
+        }
+        bool same = walked_ids.size() == walked.size()
+            && walked.size() == search_server.FindMatchedDocuments(query, DocumentStatus::ACTUAL).size()
+            && walked.size() >= top.size();
+        for (size_t i = 0; same && i < top.size(); ++i) {
+            same = walked[i].id == top[i].id;
+        }
+        mismatches += same ? 0 : 1;
+    }
+    cout << page_count << " pages, " << mismatches << " of " << queries.size() << " queries paged differently from FindTopDocuments" << endl;
+
+    // First pages of an unchanged query share its snapshot
+    paginated_search.FindPage(queries[0], 20);
+    const size_t cache_bytes = paginated_search.GetCacheMemoryUsage();
+    for (int i = 0; i < 20; ++i) {
+        paginated_search.FindPage(queries[0], 20);
+    }
+    cout << "  20 more first pages of a query pinned " << paginated_search.GetCacheMemoryUsage() - cache_bytes << " bytes" << endl;
+}
+
+// Scores and top documents of the AVX2 kernels have to agree with the scalar ones. Term frequencies
+// take few values, so many documents tie and only the rating and the offset order them
+void CheckScoreKernels() {
+    const KernelSet selected = GetSelectedKernelSet();
+    cout << "score kernels: " << (selected == KernelSet::AVX2 ? "AVX2" : "scalar") << " selected" << endl;
+    if (!HasAvx2Kernels()) {
+        cout << "  AVX2 is not supported, no second kernel set to compare with" << endl;
+        return;
+    }
+
+    mt19937 generator(11);
+    const size_t span = 100'003;
+    vector<vector<double>> term_freqs(4, vector<double>(span));
+    for (auto& freqs : term_freqs) {
+        for (double& freq : freqs) {
+            freq = uniform_int_distribution(0, 3)(generator) == 0 ? uniform_int_distribution(1, 20)(generator) / 20.0 : 0.0;
+        }
+    }
+    vector<int> ratings(span);
+    vector<DocumentMask> mask(span);
+    for (size_t i = 0; i < span; ++i) {
+        ratings[i] = uniform_int_distribution(0, 5)(generator);
+        mask[i] = uniform_int_distribution(0, 9)(generator) == 0 ? DocumentMask::EXCLUDED : DocumentMask::KEPT;
+    }
+
+    const auto score = [&](KernelSet kernel_set) {
+        vector<double> scores(span, 0.0);
+        for (size_t term = 0; term < term_freqs.size(); ++term) {
+            AccumulateScores(kernel_set, scores.data(), term_freqs[term].data(), 0.5 + term, span);
+        }
+        ApplyDocumentMask(kernel_set, scores.data(), mask.data(), span);
+        return scores;
+    };
+    const auto scalar_scores = score(KernelSet::SCALAR);
+    const auto avx2_scores = score(KernelSet::AVX2);
+    size_t compared = 0;
+    size_t mismatches = 0;
+    for (const size_t top_count : { 5, 1000 }) {
+        const auto scalar_top = SelectTopScores(KernelSet::SCALAR, scalar_scores.data(), ratings.data(), span, top_count);
+        const auto avx2_top = SelectTopScores(KernelSet::AVX2, avx2_scores.data(), ratings.data(), span, top_count);
+        compared += top_count;
+        mismatches += scalar_top.size() == avx2_top.size() ? 0 : top_count;
+        for (size_t i = 0; i < min(scalar_top.size(), avx2_top.size()); ++i) {
+            const bool same = scalar_top[i] == avx2_top[i]
+                && abs(scalar_scores[scalar_top[i]] - avx2_scores[avx2_top[i]]) < 1e-6;
+            mismatches += same ? 0 : 1;
+        }
+    }
+    cout << "  " << mismatches << " of " << compared << " top documents of the AVX2 kernels differ from the scalar ones" << endl;
+}
+
+// Plus terms go shortest posting list first, stop words vanish and unknown words are dropped. Dense minus
+// documents are excluded by a bitset, sparse ones by a sorted list. A query no plus term can match is
+// answered without scoring, and has to find what matching every document one by one finds: nothing
+void CheckQueryPlans() {
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 20'000; ++id) {
+        string text = "fur";
+        for (const auto& [word, step] : vector<pair<string, int>>{ { "cat", 2 }, { "bird", 3 }, { "dog", 10 }, { "owl", 5'000 } }) {
+            if (id % step == 0) {
+                text += " " + word;
+            }
+        }
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 7 });
+    }
+
+    int failures = 0;
+    const string dense_query = "cat and dog -bird unknownword";
+    const QueryPlan dense_plan = search_server.PlanQuery(dense_query);
+    cout << "plan of \"" << dense_query << "\":" << endl << search_server.ExplainQuery(dense_query);
+    failures += dense_plan.plus_terms.size() == 2 && dense_plan.plus_terms[0].word == "dog" && dense_plan.plus_terms[1].word == "cat" ? 0 : 1;
+    failures += dense_plan.dropped_words == vector<string>{ "unknownword" } ? 0 : 1;
+    failures += dense_plan.excluded_documents.IsBitset() ? 0 : 1;
+
+    const string sparse_query = "cat -owl";
+    const QueryPlan sparse_plan = search_server.PlanQuery(sparse_query);
+    cout << "plan of \"" << sparse_query << "\":" << endl << search_server.ExplainQuery(sparse_query);
+    failures += !sparse_plan.excluded_documents.IsEmpty() && !sparse_plan.excluded_documents.IsBitset() ? 0 : 1;
+
+    for (const string query : { "unknownword -cat", "dog -dog", "and" }) {
+        failures += search_server.PlanQuery(query).CanMatch() ? 1 : 0;
+        size_t matched = 0;
+        for (const int document_id : search_server) {
+            matched += get<0>(search_server.MatchDocument(query, document_id)).empty() ? 0 : 1;
+        }
+        const size_t found = search_server.FindTopDocuments(execution::seq, query).size()
+            + search_server.FindTopDocuments(execution::par, query).size()
+            + search_server.FindTopDocuments(search_execution::adaptive, query).size();
+        failures += matched == 0 && found == 0 ? 0 : 1;
+    }
+    cout << "query plans: " << failures << " of 8 expectations failed" << endl;
+}
+
+// MatchAllDocuments has to report every document in id order with the words MatchDocument finds for it
+template <typename ExecutionPolicy>
+size_t CountBatchMatchMismatches(const SearchServer& search_server, const string& query, ExecutionPolicy&& policy) {
+    size_t mismatches = 0;
+    auto document_id = search_server.begin();
+    search_server.MatchAllDocuments(policy, query, [&](const DocumentMatch& match) {
+        if (document_id == search_server.end() || match.document_id != *document_id) {
+            ++mismatches;
+            return;
+        }
+        const auto [words, status] = search_server.MatchDocument(query, *document_id++);
+        mismatches += words == match.words && status == match.status ? 0 : 1;
+        });
+    return mismatches + static_cast<size_t>(distance(document_id, search_server.end()));
+}
+
+void CheckBatchMatch(const SearchServer& search_server, const vector<string>& dictionary) {
+    const vector<string> queries = {
+        dictionary[1] + " " + dictionary[2],
+        dictionary[1] + " " + dictionary[2] + " -" + dictionary[3],
+        dictionary[4] + " -" + dictionary[5] + " -" + dictionary[6] + " unknownword",
+        "-" + dictionary[7],
+    };
+    size_t mismatches = 0;
+    for (const string& query : queries) {
+        mismatches += CountBatchMatchMismatches(search_server, query, execution::seq);
+        mismatches += CountBatchMatchMismatches(search_server, query, execution::par);
+    }
+    cout << "batch match of " << queries.size() << " queries under seq and par: " << mismatches << " of "
+        << 2 * queries.size() * search_server.GetDocumentCount() << " documents differ from MatchDocument" << endl;
+}
+
+// Term frequencies of 1/1000 and 1/1001 give relevances less than 1e-6 apart, so the rating orders
+// the documents on the first page as in FindTopDocuments, not the slightly higher relevance
+void CheckFirstSearchPage() {
+    string filler;
+    for (int i = 0; i < 999; ++i) {
+        filler += " filler";
+    }
+    SearchServer search_server(""s);
+    for (int id = 0; id < 200; ++id) {
+        const int kind = id % 5;
+        const string text = kind == 0 ? "cat"s + filler : kind == 1 ? "cat filler"s + filler : "dog"s + filler;
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { kind == 1 ? 5 : kind });
+    }
+    PaginatedSearch paginated_search(search_server);
+    const vector<string> queries = { "cat", "cat -dog", "dog", "cat dog" };
+    size_t mismatches = 0;
+    for (const string& query : queries) {
+        const auto top = search_server.FindTopDocuments(query);
+        const auto page = paginated_search.FindPage(query, top.size());
+        bool same = page.documents.size() == top.size();
+        for (size_t i = 0; same && i < top.size(); ++i) {
+            same = page.documents[i].id == top[i].id;
+        }
+        mismatches += same ? 0 : 1;
+    }
+    cout << "first search page of near ties: " << mismatches << " of " << queries.size()
+        << " queries differ from FindTopDocuments" << endl;
+}
+
+// Queries pass through a request queue that records them, then the log is played back at the recorded rate
+void RecordAndReplayQueries(const SearchServer& search_server, const vector<string>& queries) {
+    stringstream log_stream;
+    QueryLogWriter query_log(log_stream);
+    RequestQueue request_queue(search_server, &query_log);
+    for (const string& query : queries) {
+        request_queue.AddFindRequest(query);
+    }
+    // The filter of a custom predicate is not recorded, so the replay skips this request
+    request_queue.AddFindRequest(queries.front(), [](int, DocumentStatus, int rating) { return rating > 1; });
+    const QueryLog log = ReadQueryLog(log_stream);
+    cout << "query log of " << log.records.size() << " requests, " << log_stream.str().size() << " bytes" << endl;
+    for (const size_t thread_count : { 1, 4 }) {
+        cout << "replay on " << thread_count << (thread_count == 1 ? " thread: " : " threads: ")
+            << ReplayQueryLog(search_server, log, { thread_count, 1.0 });
+    }
+}
+
+#ifndef _WIN32
+// Serves every partition from a worker process, on Unix sockets and loopback TCP in turn, and routes the
+// queries through them. Runs before any thread is started, as the workers are forked
+vector<RoutedSearchResult> RouteQueries(const string& mark, const vector<SearchServer>& partitions, const vector<string>& queries) {
+    vector<PartitionEndpoint> endpoints;
+    vector<pid_t> workers;
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        endpoints.push_back(i % 2 == 0
+            ? PartitionEndpoint::Unix((filesystem::temp_directory_path() / ("search_partition_" + to_string(i) + ".sock")).string())
+            : PartitionEndpoint::LoopbackTcp(0));
+        workers.push_back(SpawnPartitionWorker(partitions[i], endpoints.back()));
+    }
+
+    vector<RoutedSearchResult> results;
+    try {
+        QueryRouter router(endpoints, chrono::milliseconds(5'000));
+        LOG_DURATION(mark);
+        for (const string& query : queries) {
+            results.push_back(router.FindTopDocuments(query));
+        }
+    }
+    catch (const exception& e) {
+        cout << mark << " failed: " << e.what() << endl;
+        results.clear();
+    }
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        StopPartitionWorker(workers[i], endpoints[i]);
+    }
+    return results;
+}
+
+// Counts the queries whose routed top documents differ from the ones of a single server over the whole corpus
+size_t CountRoutingMismatches(const SearchServer& search_server, const vector<string>& queries, const vector<RoutedSearchResult>& routed) {
+    if (routed.size() != queries.size()) {
+        return queries.size();
+    }
+    size_t mismatches = 0;
+    for (size_t query = 0; query < queries.size(); ++query) {
+        const auto expected = search_server.FindTopDocuments(queries[query]);
+        const auto& documents = routed[query].documents;
+        bool same = routed[query].IsComplete() && documents.size() == expected.size();
+        for (size_t i = 0; same && i < expected.size(); ++i) {
+            same = documents[i].id == expected[i].id && abs(documents[i].relevance - expected[i].relevance) < 1e-6;
+        }
+        mismatches += same ? 0 : 1;
+    }
+    return mismatches;
+}
+
+// Splits the corpus between four worker processes and checks the router against a single server
+void CompareRoutedSearch(const string& stop_words, const SearchServer& search_server,
+    const vector<string>& documents, const vector<string>& queries) {
+    const size_t partition_count = 4;
+    vector<SearchServer> partitions(partition_count, SearchServer(stop_words));
+    for (size_t i = 0; i < documents.size(); ++i) {
+        partitions[i % partition_count].AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    const size_t mismatches = CountRoutingMismatches(search_server, queries, RouteQueries("routed search", partitions, queries));
+    cout << "routed search over " << partition_count << " partitions: " << mismatches << " of " << queries.size()
+        << " queries differ from a single server" << endl;
+}
+
+// Forks a process that answers every request on the endpoint with the same bytes
+pid_t SpawnMalformedPartition(PartitionEndpoint& endpoint, const string& reply) {
+    Socket listener = ListenOn(endpoint);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        try {
+            for (;;) {
+                Socket client = AcceptConnection(listener);
+                char buffer[4096];
+                while (recv(client.Get(), buffer, sizeof(buffer), 0) > 0) {
+                    send(client.Get(), reply.data(), reply.size(), MSG_NOSIGNAL);
+                }
+            }
+        }
+        catch (...) {
+        }
+        _exit(0);
+    }
+    return pid;
+}
+
+// One partition answers every request with a malformed response: a frame of invalid size, a well-framed
+// response of the wrong type or a well-framed statistics response with a truncated payload. The router
+// has to drop that partition and keep answering from the others, query after query
+void CheckRoutedBadFrame() {
+    SearchServer partition(""s);
+    partition.AddDocument(1, "white cat", DocumentStatus::ACTUAL, { 1 });
+    partition.AddDocument(2, "black dog", DocumentStatus::ACTUAL, { 2 });
+    const vector<pair<string, string>> replies = {
+        { "a frame of invalid size", "\xff\xff\xff\xff\x02"s },
+        { "a response of the wrong type", "\x01\x00\x00\x00\x01"s },
+        { "a truncated payload", "\x03\x00\x00\x00\x02\x00\x00"s },
+    };
+    const vector<string> queries = { "cat", "dog", "white dog" };
+    for (const auto& [mark, reply] : replies) {
+        vector<PartitionEndpoint> endpoints = { PartitionEndpoint::LoopbackTcp(0), PartitionEndpoint::LoopbackTcp(0) };
+        const pid_t worker = SpawnPartitionWorker(partition, endpoints[0]);
+        const pid_t bad_worker = SpawnMalformedPartition(endpoints[1], reply);
+
+        size_t dropped_only_bad = 0;
+        try {
+            QueryRouter router(endpoints, chrono::milliseconds(5'000));
+            for (const string& query : queries) {
+                const auto result = router.FindTopDocuments(query);
+                const auto expected = partition.FindTopDocuments(query);
+                bool same = result.failed_partitions == vector<size_t>{ 1 } && result.documents.size() == expected.size();
+                for (size_t i = 0; same && i < expected.size(); ++i) {
+                    same = result.documents[i].id == expected[i].id;
+                }
+                dropped_only_bad += same ? 1 : 0;
+            }
+        }
+        catch (const exception& e) {
+            cout << "routed search with a partition sending " << mark << " failed: " << e.what() << endl;
+        }
+        StopPartitionWorker(worker, endpoints[0]);
+        StopPartitionWorker(bad_worker, endpoints[1]);
+        cout << "routed search with a partition sending " << mark << ": " << dropped_only_bad << " of " << queries.size()
+            << " queries dropped only that partition" << endl;
+    }
+}
+
+// Documents with the same words and ratings are spread over the partitions, so the top documents of
+// every query tie on relevance and rating across partitions and only the id orders them
+void CompareRoutedTies() {
+    const size_t partition_count = 3;
+    const vector<string> texts = { "white cat", "black dog", "white cat black dog" };
+    SearchServer search_server(""s);
+    vector<SearchServer> partitions(partition_count, SearchServer(""s));
+    for (int id = 0; id < 60; ++id) {
+        const string& text = texts[id % texts.size()];
+        const vector<int> ratings = { id % 4 < 2 ? 5 : 3 };
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, ratings);
+        partitions[(id / 2) % partition_count].AddDocument(id, text, DocumentStatus::ACTUAL, ratings);
+    }
+    const vector<string> queries = { "cat", "dog", "white dog", "black cat -white", "cat dog" };
+    const size_t mismatches = CountRoutingMismatches(search_server, queries, RouteQueries("routed ties", partitions, queries));
+    cout << "routed search of tied documents: " << mismatches << " of " << queries.size() << " queries differ from a single server" << endl;
+}
 
+// Documents with the same words but different ratings sit on partitions where other documents make
+// different query words the rarest. Each partition adds the terms in its own order, so the relevances
+// of the tied documents differ in the last bits, and only the rating may order them, as on a single server
+void CompareRoutedNearTies() {
+    const size_t partition_count = 3;
+    const vector<string> words = { "alpha", "bravo", "charlie", "delta", "echo" };
+    SearchServer search_server(""s);
+    vector<SearchServer> partitions(partition_count, SearchServer(""s));
+    int id = 0;
+    for (; id < 30; ++id) {
+        const vector<int> ratings = { id % 3 };
+        search_server.AddDocument(id, "alpha bravo charlie delta echo", DocumentStatus::ACTUAL, ratings);
+        partitions[id % partition_count].AddDocument(id, "alpha bravo charlie delta echo", DocumentStatus::ACTUAL, ratings);
+    }
+    for (size_t partition = 0; partition < partition_count; ++partition) {
+        for (size_t word = 0; word < words.size(); ++word) {
+            for (size_t copy = 0; copy < (word + 2 * partition) % words.size() * 3; ++copy, ++id) {
+                const string text = words[word] + " filler filler filler filler filler filler filler filler filler";
+                search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { 0 });
+                partitions[partition].AddDocument(id, text, DocumentStatus::ACTUAL, { 0 });
+            }
+        }
+    }
+    const vector<string> queries = { "alpha bravo charlie delta echo", "echo delta charlie", "bravo delta -filler" };
+    const size_t mismatches = CountRoutingMismatches(search_server, queries, RouteQueries("routed near ties", partitions, queries));
+    cout << "routed search of near ties with different ratings: " << mismatches << " of " << queries.size()
+        << " queries differ from a single server" << endl;
+}
+#endif
+
+#ifndef _WIN32
+// Restarting from a snapshot replays only the mutations after it, a full reload adds the whole corpus again
+void CompareRecoveryWithReload(const string& stop_words, const vector<string>& documents) {
+    const string directory = (filesystem::temp_directory_path() / "search_server_durability").string();
+    filesystem::remove_all(directory);
+    {
+        LOG_DURATION("durable writes");
+        DurableSearchServer search_server(directory, stop_words, { IndexMemoryMode::HEAP, 8'000 });
+        const size_t writer_count = 4;
+        vector<thread> writers;
+        for (size_t writer = 0; writer < writer_count; ++writer) {
+            writers.emplace_back([&, writer] {
+                for (size_t i = writer; i < documents.size(); i += writer_count) {
+                    search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+                }
+                });
+        }
+        for (thread& writer : writers) {
+            writer.join();
+        }
+        for (size_t i = 0; i < documents.size(); i += 10) {
+            search_server.RemoveDocument(i);
+        }
+        // A duplicate id, a negative id and a word with a control character never reach the log
+        const uint64_t logged = search_server.GetLogStats().records;
+        int rejected = 0;
+        for (const auto& [document_id, text] : vector<pair<int, string>>{ { 1, "cat" }, { -1, "cat" }, { 20'000, "c\x01t" } }) {
+            try {
+                search_server.AddDocument(document_id, text, DocumentStatus::ACTUAL, { 1 });
+            }
+            catch (const invalid_argument&) {
+                ++rejected;
+            }
+        }
+        const auto stats = search_server.GetLogStats();
+        cout << "  " << stats.records << " mutations logged with " << stats.syncs << " fsyncs, " << rejected
+            << " invalid mutations rejected" << (stats.records == logged ? " before logging" : " after logging") << endl;
+    }
+    {
+        unique_ptr<DurableSearchServer> search_server;
+        {
+            LOG_DURATION("durable recovery");
+            search_server = make_unique<DurableSearchServer>(directory, stop_words);
+        }
+        const auto stats = search_server->GetRecoveryStats();
+        cout << "  snapshot of " << stats.snapshot_documents << " documents after mutation " << stats.snapshot_sequence
+            << ", " << stats.replayed_mutations << " mutations replayed, " << search_server->GetSearchServer().GetDocumentCount()
+            << " documents" << endl;
+    }
+    {
+        SearchServer search_server(stop_words);
+        LOG_DURATION("full reload");
+        for (size_t i = 0; i < documents.size(); ++i) {
+            if (i % 10 != 0) {
+                search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+            }
+        }
+    }
+    filesystem::remove_all(directory);
+}
+
+string FindLogSegment(const string& directory) {
+    for (const auto& entry : filesystem::directory_iterator(directory)) {
+        if (entry.path().extension() == ".log") {
+            return entry.path().string();
+        }
+    }
+    return {};
+}
+
+// A crash in the middle of the last record leaves a torn tail: reopening cuts it off and keeps every record
+// written before it. A torn segment left behind by a crash after a checkpoint is covered by the snapshot
+void CheckDurableRecovery() {
+    const string directory = (filesystem::temp_directory_path() / "search_server_torn_log").string();
+    const string torn_copy = directory + ".torn";
+    filesystem::remove_all(directory);
+    const int document_count = 100;
+    size_t size_before_last = 0;
+    size_t size_after_last = 0;
+    {
+        DurableSearchServer search_server(directory, ""s, { IndexMemoryMode::HEAP, 0 });
+        for (int id = 0; id < document_count; ++id) {
+            if (id + 1 == document_count) {
+                size_before_last = filesystem::file_size(FindLogSegment(directory));
+            }
+            search_server.AddDocument(id, "cat number " + to_string(id), DocumentStatus::ACTUAL, { id });
+        }
+        size_after_last = filesystem::file_size(FindLogSegment(directory));
+    }
+    const string segment = FindLogSegment(directory);
+    filesystem::resize_file(segment, (size_before_last + size_after_last) / 2);
+    filesystem::copy_file(segment, torn_copy, filesystem::copy_options::overwrite_existing);
+
+    try {
+        {
+            DurableSearchServer search_server(directory, ""s, { IndexMemoryMode::HEAP, 0 });
+            const auto stats = search_server.GetRecoveryStats();
+            cout << "torn log tail: " << stats.discarded_bytes << " bytes discarded, " << search_server.GetSearchServer().GetDocumentCount()
+                << " of " << document_count - 1 << " documents whose records were written whole recovered" << endl;
+            search_server.AddDocument(document_count, "cat after the torn tail", DocumentStatus::ACTUAL, { 1 });
+            search_server.Checkpoint();
+        }
+        // A crash before the checkpoint deleted the segment it replaced
+        filesystem::copy_file(torn_copy, segment, filesystem::copy_options::overwrite_existing);
+        DurableSearchServer search_server(directory, ""s, { IndexMemoryMode::HEAP, 0 });
+        const auto stats = search_server.GetRecoveryStats();
+        cout << "torn segment left by a checkpoint: snapshot after mutation " << stats.snapshot_sequence << ", "
+            << stats.replayed_mutations << " mutations replayed, " << search_server.GetSearchServer().GetDocumentCount() << " of "
+            << document_count << " documents" << endl;
+    }
+    catch (const exception& e) {
+        cout << "durable recovery failed: " << e.what() << endl;
+    }
+    filesystem::remove_all(directory);
+    filesystem::remove(torn_copy);
+}
+#endif
+
+// Sprint4 replay SNAPSHOT QUERY_LOG [THREADS] [SPEEDUP]: loads the index from a snapshot and replays a query log against it
+int ReplayCommand(int argc, char* argv[]) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " replay SNAPSHOT QUERY_LOG [THREADS] [SPEEDUP]" << endl;
+        return 1;
+    }
+    try {
+        ifstream snapshot(argv[2], ios::binary);
+        ifstream query_log(argv[3], ios::binary);
+        if (!snapshot || !query_log) {
+            throw runtime_error("Failed to open the snapshot or the query log");
+        }
+        QueryReplayOptions options;
+        if (argc > 4) {
+            options.thread_count = stoul(argv[4]);
+        }
+        if (argc > 5) {
+            options.speedup = stod(argv[5]);
+        }
+        SearchServer search_server(SearchServer::ReadSnapshotStopWords(snapshot));
+        snapshot.seekg(0);
+        search_server.LoadSnapshot(snapshot);
+        const QueryLog log = ReadQueryLog(query_log);
+        cout << search_server.GetDocumentCount() << " documents, " << log.records.size() << " queries" << endl;
+        cout << ReplayQueryLog(search_server, log, options);
+    }
+    catch (const exception& e) {
+        cerr << "Replay failed: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "replay") {
+        return ReplayCommand(argc, argv);
+    }
 
     mt19937 generator;
 
@@ -79,6 +834,68 @@ int main() {
 
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
 
+#ifndef _WIN32
+    CompareRoutedSearch(dictionary[0], search_server, documents, queries);
+    CompareRoutedTies();
+    CompareRoutedNearTies();
+    CheckRoutedBadFrame();
+#endif
+
+    CheckColdProcessQueries();
+
+    // The partition workers above are forked while the process has a single thread. Nothing may start a thread
+    // before them: the cold ProcessQueries check and this startup hook both start the threads of the pool.
+    // ProcessQueries has already calibrated the tuner by now, so the hook only returns; it stays where a server calls it
+    ExecutionTuner::Instance().CalibrateOnce();
+
+    CheckLargestDocumentId();
+    CheckPinnedExecutor(search_server, queries);
+    CheckScoreKernels();
+
     TEST(seq);
     TEST(par);
+    Test("work_stealing", search_server, queries, search_execution::work_stealing);
+    Test("adaptive", search_server, queries, search_execution::adaptive);
+
+    const auto thresholds = ExecutionTuner::Instance().GetThresholds();
+    const auto counters = ExecutionTuner::Instance().GetCounters();
+    cout << "adaptive thresholds: par from " << thresholds.parallel_work << ", partitioned from " << thresholds.partitioned_work
+        << ", grain " << thresholds.grain_size << endl;
+    cout << "adaptive choices: seq " << counters.sequential << ", par " << counters.parallel
+        << ", partitioned " << counters.partitioned << endl;
+
+    ReportFrequencyPrecision(search_server, queries);
+
+    // Every word of the dictionary: the query scores every posting of the index
+    string everything;
+    for (const string& word : dictionary) {
+        everything += (everything.empty() ? "" : " ") + word;
+    }
+    SearchWithBudget("search without a budget", search_server, everything, SearchBudget{}, execution::seq);
+    SearchWithBudget("search within 5 ms", search_server, everything, SearchBudget::Timeout(chrono::milliseconds(5)), execution::seq);
+    SearchWithBudget("search within 100000 postings", search_server, everything, SearchBudget::Postings(100'000), execution::seq);
+    SearchWithBudget("par search within 5 ms", search_server, everything, SearchBudget::Timeout(chrono::milliseconds(5)), execution::par);
+    SearchWithBudget("par search within 100000 postings", search_server, everything, SearchBudget::Postings(100'000), execution::par);
+    CheckBudgetedProcessQueries(search_server, queries);
+
+    CheckQueryPlans();
+    CheckBatchMatch(search_server, dictionary);
+
+    WalkSearchPages(search_server, queries);
+    CheckFirstSearchPage();
+
+    RecordAndReplayQueries(search_server, queries);
+
+    BenchmarkConcurrentMaps();
+
+    CompareIndexMemoryModes(dictionary[0], documents, queries);
+
+    CheckServerMove(dictionary[0], documents, queries);
+
+    CompareImpactOrder(dictionary[0], documents, dictionary);
+
+#ifndef _WIN32
+    CompareRecoveryWithReload(dictionary[0], documents);
+    CheckDurableRecovery();
+#endif
 }
@@ -0,0 +1,97 @@
+#include "memory_resources.h"
+
+using namespace std;
+
+void MemoryCounters::RecordAllocation(size_t bytes) {
+    allocations_.fetch_add(1, memory_order_relaxed);
+    const size_t in_use = bytes_in_use_.fetch_add(bytes, memory_order_relaxed) + bytes;
+    size_t peak = peak_bytes_in_use_.load(memory_order_relaxed);
+    while (peak < in_use && !peak_bytes_in_use_.compare_exchange_weak(peak, in_use, memory_order_relaxed)) {
+    }
+}
+
+void MemoryCounters::RecordDeallocation(size_t bytes) {
+    deallocations_.fetch_add(1, memory_order_relaxed);
+    bytes_in_use_.fetch_sub(bytes, memory_order_relaxed);
+}
+
+MemoryResourceStats MemoryCounters::GetStats() const {
+    return { allocations_.load(), deallocations_.load(), bytes_in_use_.load(), peak_bytes_in_use_.load() };
+}
+
+CountingMemoryResource::CountingMemoryResource(pmr::memory_resource* upstream, MemoryCounters& counters)
+    : upstream_(upstream)
+    , counters_(counters) {
+}
+
+void* CountingMemoryResource::do_allocate(size_t bytes, size_t alignment) {
+    void* p = upstream_->allocate(bytes, alignment);
+    counters_.RecordAllocation(bytes);
+    return p;
+}
+
+void CountingMemoryResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    upstream_->deallocate(p, bytes, alignment);
+    counters_.RecordDeallocation(bytes);
+}
+
+bool CountingMemoryResource::do_is_equal(const pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+namespace {
+
+unique_ptr<pmr::memory_resource> MakeIndexResource(IndexMemoryMode mode, pmr::memory_resource* upstream) {
+    if (mode == IndexMemoryMode::HEAP) {
+        return nullptr;
+    }
+    // RemoveDocument with a parallel policy frees nodes of different posting lists concurrently
+    return make_unique<pmr::synchronized_pool_resource>(upstream);
+}
+
+unique_ptr<pmr::memory_resource> MakePostingsResource(IndexMemoryMode mode, pmr::memory_resource* upstream) {
+    if (mode != IndexMemoryMode::MONOTONIC) {
+        return nullptr;
+    }
+    return make_unique<pmr::monotonic_buffer_resource>(upstream);
+}
+
+} // namespace
+
+IndexMemoryResource::IndexMemoryResource(IndexMemoryMode mode)
+    : mode_(mode)
+    , upstream_(pmr::new_delete_resource(), upstream_counters_)
+    , resource_(MakeIndexResource(mode, &upstream_))
+    , postings_resource_(MakePostingsResource(mode, &upstream_))
+    , counted_(resource_ ? resource_.get() : &upstream_, counters_)
+    , counted_postings_(postings_resource_ ? postings_resource_.get() : &upstream_, counters_) {
+}
+
+pmr::memory_resource* IndexMemoryResource::GetPostings() {
+    return postings_resource_ ? &counted_postings_ : &counted_;
+}
+
+pmr::memory_resource* IndexMemoryResource::Get() {
+    return &counted_;
+}
+
+IndexMemoryMode IndexMemoryResource::GetMode() const {
+    return mode_;
+}
+
+MemoryResourceStats IndexMemoryResource::GetStats() const {
+    return counters_.GetStats();
+}
+
+MemoryResourceStats IndexMemoryResource::GetUpstreamStats() const {
+    return upstream_counters_.GetStats();
+}
+
+QueryScratchArena::QueryScratchArena(MemoryCounters& counters)
+    : arena_(buffer_, kBufferSize, pmr::new_delete_resource())
+    , counted_(&arena_, counters) {
+}
+
+pmr::memory_resource* QueryScratchArena::Get() {
+    return &counted_;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+
+struct MemoryResourceStats {
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    size_t bytes_in_use = 0;
+    size_t peak_bytes_in_use = 0;
+};
+
+// Allocation counters that can be shared by several CountingMemoryResource objects and threads
+class MemoryCounters {
+public:
+    void RecordAllocation(size_t bytes);
+    void RecordDeallocation(size_t bytes);
+    MemoryResourceStats GetStats() const;
+
+private:
+    std::atomic<uint64_t> allocations_{ 0 };
+    std::atomic<uint64_t> deallocations_{ 0 };
+    std::atomic<size_t> bytes_in_use_{ 0 };
+    std::atomic<size_t> peak_bytes_in_use_{ 0 };
+};
+
+// Forwards to the upstream resource and records every request in the counters
+class CountingMemoryResource : public std::pmr::memory_resource {
+public:
+    CountingMemoryResource(std::pmr::memory_resource* upstream, MemoryCounters& counters);
+
+private:
+    std::pmr::memory_resource* upstream_;
+    MemoryCounters& counters_;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+enum class IndexMemoryMode {
+    // Every node comes from operator new
+    HEAP,
+    // Nodes come from size-class pools, memory of removed documents is reused
+    POOLED,
+    // Posting lists are bump-allocated from large blocks, the per-document structures come from
+    // size-class pools as in POOLED. RemoveDocument returns the term vector and the impact postings
+    // of the document for reuse, but its posting nodes stay in the blocks until the index is destroyed.
+    // Best for an index that is built once and removes few documents
+    MONOTONIC,
+};
+
+// Memory resources of an index, with counters for the requests of the containers
+// and for the memory the resources themselves take from the heap
+class IndexMemoryResource {
+public:
+    explicit IndexMemoryResource(IndexMemoryMode mode);
+
+    IndexMemoryResource(const IndexMemoryResource&) = delete;
+    IndexMemoryResource& operator=(const IndexMemoryResource&) = delete;
+
+    // For the posting lists
+    std::pmr::memory_resource* GetPostings();
+    // For everything else, which RemoveDocument frees
+    std::pmr::memory_resource* Get();
+    IndexMemoryMode GetMode() const;
+    MemoryResourceStats GetStats() const;
+    MemoryResourceStats GetUpstreamStats() const;
+
+private:
+    IndexMemoryMode mode_;
+    MemoryCounters upstream_counters_;
+    CountingMemoryResource upstream_;
+    std::unique_ptr<std::pmr::memory_resource> resource_;
+    std::unique_ptr<std::pmr::memory_resource> postings_resource_;
+    MemoryCounters counters_;
+    CountingMemoryResource counted_;
+    CountingMemoryResource counted_postings_;
+};
+
+// Scratch memory of one query: a buffer on the stack first, then heap blocks.
+// Everything is released at once when the arena goes out of scope. Not thread-safe
+class QueryScratchArena {
+public:
+    explicit QueryScratchArena(MemoryCounters& counters);
+
+    QueryScratchArena(const QueryScratchArena&) = delete;
+    QueryScratchArena& operator=(const QueryScratchArena&) = delete;
+
+    std::pmr::memory_resource* Get();
+
+private:
+    static constexpr size_t kBufferSize = 8192;
+
+    alignas(std::max_align_t) std::byte buffer_[kBufferSize];
+    std::pmr::monotonic_buffer_resource arena_;
+    CountingMemoryResource counted_;
+};
@@ -0,0 +1,291 @@
+#include "mutation_log.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Upper bound on a single record, guards against reading garbage as a length
+const uint32_t kMaxRecordSize = 64u << 20;
+const size_t kRecordHeaderSize = 8;
+
+runtime_error SystemError(const string& what) {
+    return runtime_error(what + ": " + strerror(errno));
+}
+
+array<uint32_t, 256> MakeCrcTable() {
+    array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t value = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+        }
+        table[i] = value;
+    }
+    return table;
+}
+
+uint32_t Crc32(string_view data) {
+    static const array<uint32_t, 256> table = MakeCrcTable();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (const char c : data) {
+        crc = table[(crc ^ static_cast<uint8_t>(c)) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void PutU32(string& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<char>(value >> shift));
+    }
+}
+
+uint32_t GetU32(string_view& in) {
+    if (in.size() < 4) {
+        throw runtime_error("Truncated mutation log record");
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+    }
+    in.remove_prefix(4);
+    return value;
+}
+
+void AppendRecord(string& out, uint64_t sequence, const IndexMutation& mutation) {
+    string payload;
+    PutU32(payload, static_cast<uint32_t>(sequence));
+    PutU32(payload, static_cast<uint32_t>(sequence >> 32));
+    payload.push_back(static_cast<char>(mutation.type));
+    PutU32(payload, static_cast<uint32_t>(mutation.document_id));
+    if (mutation.type == IndexMutation::Type::ADD) {
+        PutU32(payload, static_cast<uint32_t>(mutation.status));
+        PutU32(payload, static_cast<uint32_t>(mutation.ratings.size()));
+        for (const int rating : mutation.ratings) {
+            PutU32(payload, static_cast<uint32_t>(rating));
+        }
+        PutU32(payload, static_cast<uint32_t>(mutation.document.size()));
+        payload += mutation.document;
+    }
+    if (payload.size() > kMaxRecordSize) {
+        throw invalid_argument("Document is too large for the mutation log");
+    }
+    PutU32(out, static_cast<uint32_t>(payload.size()));
+    PutU32(out, Crc32(payload));
+    out += payload;
+}
+
+IndexMutation ParseMutation(string_view payload, uint64_t& sequence) {
+    const uint64_t low = GetU32(payload);
+    const uint64_t high = GetU32(payload);
+    sequence = low | (high << 32);
+    if (payload.empty()) {
+        throw runtime_error("Truncated mutation log record");
+    }
+    IndexMutation mutation;
+    mutation.type = static_cast<IndexMutation::Type>(payload[0]);
+    payload.remove_prefix(1);
+    mutation.document_id = static_cast<int>(GetU32(payload));
+    if (mutation.type == IndexMutation::Type::ADD) {
+        mutation.status = static_cast<DocumentStatus>(GetU32(payload));
+        for (uint32_t i = GetU32(payload); i > 0; --i) {
+            mutation.ratings.push_back(static_cast<int>(GetU32(payload)));
+        }
+        const uint32_t size = GetU32(payload);
+        if (payload.size() < size) {
+            throw runtime_error("Truncated mutation log record");
+        }
+        mutation.document = payload.substr(0, size);
+    }
+    else if (mutation.type != IndexMutation::Type::REMOVE) {
+        throw runtime_error("Unknown mutation log record type");
+    }
+    return mutation;
+}
+
+void WriteAll(int fd, string_view data, const string& path) {
+    while (!data.empty()) {
+        const ssize_t written = write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SystemError("Failed to write " + path);
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+}
+
+void SyncFile(int fd, const string& path) {
+    if (fsync(fd) != 0) {
+        throw SystemError("Failed to sync " + path);
+    }
+}
+
+string GetDirectory(const string& path) {
+    const size_t slash = path.rfind('/');
+    if (slash == string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+} // namespace
+
+size_t ReadMutationLog(const string& path, const function<void(uint64_t sequence, IndexMutation mutation)>& handler) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        throw runtime_error("Failed to open " + path);
+    }
+    const string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    size_t valid_size = 0;
+    string_view rest = contents;
+    while (rest.size() >= kRecordHeaderSize) {
+        string_view header = rest.substr(0, kRecordHeaderSize);
+        const uint32_t size = GetU32(header);
+        const uint32_t crc = GetU32(header);
+        if (size > kMaxRecordSize || rest.size() - kRecordHeaderSize < size) {
+            break;
+        }
+        const string_view payload = rest.substr(kRecordHeaderSize, size);
+        if (Crc32(payload) != crc) {
+            break;
+        }
+        uint64_t sequence = 0;
+        IndexMutation mutation = ParseMutation(payload, sequence);
+        handler(sequence, move(mutation));
+        rest.remove_prefix(kRecordHeaderSize + size);
+        valid_size += kRecordHeaderSize + size;
+    }
+    return valid_size;
+}
+
+void WriteFileDurably(const string& path, string_view data) {
+    const string temporary_path = path + ".tmp";
+    const int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw SystemError("Failed to create " + temporary_path);
+    }
+    try {
+        WriteAll(fd, data, temporary_path);
+        SyncFile(fd, temporary_path);
+    }
+    catch (...) {
+        close(fd);
+        unlink(temporary_path.c_str());
+        throw;
+    }
+    close(fd);
+    if (rename(temporary_path.c_str(), path.c_str()) != 0) {
+        throw SystemError("Failed to rename " + temporary_path);
+    }
+    SyncDirectory(GetDirectory(path));
+}
+
+void SyncDirectory(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw SystemError("Failed to open directory " + path);
+    }
+    const int result = fsync(fd);
+    close(fd);
+    if (result != 0) {
+        throw SystemError("Failed to sync directory " + path);
+    }
+}
+
+MutationLog::MutationLog(string path, size_t valid_size, uint64_t next_sequence)
+    : path_(move(path))
+    , last_sequence_(next_sequence - 1)
+    , durable_sequence_(next_sequence - 1) {
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+        throw SystemError("Failed to open " + path_);
+    }
+    if (ftruncate(fd_, static_cast<off_t>(valid_size)) != 0) {
+        const runtime_error error = SystemError("Failed to truncate " + path_);
+        close(fd_);
+        throw error;
+    }
+    try {
+        SyncFile(fd_, path_);
+        SyncDirectory(GetDirectory(path_));
+    }
+    catch (...) {
+        close(fd_);
+        throw;
+    }
+}
+
+MutationLog::~MutationLog() {
+    close(fd_);
+}
+
+uint64_t MutationLog::Append(const IndexMutation& mutation) {
+    lock_guard<mutex> guard(mutex_);
+    if (!error_.empty()) {
+        throw runtime_error(error_);
+    }
+    AppendRecord(pending_, last_sequence_ + 1, mutation);
+    ++stats_.records;
+    return ++last_sequence_;
+}
+
+void MutationLog::Sync(uint64_t sequence) {
+    unique_lock<mutex> lock(mutex_);
+    while (durable_sequence_ < sequence) {
+        if (!error_.empty()) {
+            throw runtime_error(error_);
+        }
+        if (syncing_) {
+            synced_.wait(lock);
+            continue;
+        }
+
+        // This thread commits everything buffered so far, the records of the waiting threads included
+        syncing_ = true;
+        const string batch = move(pending_);
+        pending_.clear();
+        const uint64_t batch_sequence = last_sequence_;
+        lock.unlock();
+        string error;
+        try {
+            WriteAll(fd_, batch, path_);
+            SyncFile(fd_, path_);
+        }
+        catch (const exception& e) {
+            error = e.what();
+        }
+        lock.lock();
+
+        syncing_ = false;
+        if (error.empty()) {
+            durable_sequence_ = batch_sequence;
+            ++stats_.syncs;
+        }
+        else {
+            error_ = "Mutation log failed: " + error;
+        }
+        synced_.notify_all();
+    }
+}
+
+uint64_t MutationLog::GetLastSequence() const {
+    lock_guard<mutex> guard(mutex_);
+    return last_sequence_;
+}
+
+MutationLogStats MutationLog::GetStats() const {
+    lock_guard<mutex> guard(mutex_);
+    return stats_;
+}
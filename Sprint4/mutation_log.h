@@ -0,0 +1,73 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+// POSIX only: append-only log of index mutations with group commit.
+// Every record is a little-endian uint32 payload length, the CRC-32 of the payload and the payload.
+
+struct IndexMutation {
+    enum class Type : uint8_t {
+        ADD = 1,
+        REMOVE,
+    };
+
+    Type type = Type::ADD;
+    int document_id = 0;
+    // The fields below are used by ADD only
+    std::string document;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+struct MutationLogStats {
+    uint64_t records = 0;
+    uint64_t syncs = 0;
+};
+
+// Passes the records of a log file to handler in order and returns the size of the valid prefix.
+// The log ends at the first record that is cut short or fails its checksum
+size_t ReadMutationLog(const std::string& path, const std::function<void(uint64_t sequence, IndexMutation mutation)>& handler);
+
+// Replaces the file with data so that a crash leaves either the old or the new contents
+void WriteFileDurably(const std::string& path, std::string_view data);
+void SyncDirectory(const std::string& path);
+
+// Append only buffers a record. Sync writes and fsyncs everything buffered so far, so while one
+// thread waits for its fsync the records of other threads accumulate and share the next one
+class MutationLog {
+public:
+    // Creates the file or cuts it to valid_size, dropping a torn tail. Records are numbered from next_sequence
+    MutationLog(std::string path, size_t valid_size, uint64_t next_sequence);
+    MutationLog(const MutationLog&) = delete;
+    MutationLog& operator=(const MutationLog&) = delete;
+    // Records that were not synced are lost, as in a crash
+    ~MutationLog();
+
+    // Returns the sequence number of the record
+    uint64_t Append(const IndexMutation& mutation);
+    // Returns once the record with the sequence number and all before it are on disk
+    void Sync(uint64_t sequence);
+
+    uint64_t GetLastSequence() const;
+    MutationLogStats GetStats() const;
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    std::condition_variable synced_;
+    std::string pending_;
+    uint64_t last_sequence_;
+    uint64_t durable_sequence_;
+    bool syncing_ = false;
+    // After a failed write the end of the file is unknown, so the log refuses further records
+    std::string error_;
+    MutationLogStats stats_;
+};
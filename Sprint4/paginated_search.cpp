@@ -0,0 +1,329 @@
+#include "paginated_search.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+struct SearchCursor {
+    uint64_t snapshot_id = 0;
+    uint64_t index_version = 0;
+    uint64_t query_hash = 0;
+    // Size of the first page, its documents are left out of the later pages
+    uint64_t first_page_size = 0;
+    // Pages before the next one. After the first page the last document of the previous page
+    // is the position the next page starts after
+    uint64_t page_count = 0;
+    double relevance = 0.0;
+    int rating = 0;
+    int document_id = 0;
+};
+
+const char kHexDigits[] = "0123456789abcdef";
+
+template <typename Value>
+void AppendHex(string& out, Value value) {
+    unsigned char bytes[sizeof(Value)];
+    memcpy(bytes, &value, sizeof(Value));
+    for (const unsigned char byte : bytes) {
+        out.push_back(kHexDigits[byte >> 4]);
+        out.push_back(kHexDigits[byte & 0xF]);
+    }
+}
+
+int ParseHexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    throw invalid_argument("Invalid search cursor");
+}
+
+template <typename Value>
+Value ParseHex(string_view& in) {
+    unsigned char bytes[sizeof(Value)];
+    for (unsigned char& byte : bytes) {
+        byte = static_cast<unsigned char>(ParseHexDigit(in[0]) << 4 | ParseHexDigit(in[1]));
+        in.remove_prefix(2);
+    }
+    Value value;
+    memcpy(&value, bytes, sizeof(Value));
+    return value;
+}
+
+const size_t kCursorLength = 2 * (5 * sizeof(uint64_t) + sizeof(double) + 2 * sizeof(int));
+
+string EncodeSearchCursor(const SearchCursor& cursor) {
+    string out;
+    out.reserve(kCursorLength);
+    AppendHex(out, cursor.snapshot_id);
+    AppendHex(out, cursor.index_version);
+    AppendHex(out, cursor.query_hash);
+    AppendHex(out, cursor.first_page_size);
+    AppendHex(out, cursor.page_count);
+    AppendHex(out, cursor.relevance);
+    AppendHex(out, cursor.rating);
+    AppendHex(out, cursor.document_id);
+    return out;
+}
+
+SearchCursor DecodeSearchCursor(string_view in) {
+    if (in.size() != kCursorLength) {
+        throw invalid_argument("Invalid search cursor");
+    }
+    SearchCursor cursor;
+    cursor.snapshot_id = ParseHex<uint64_t>(in);
+    cursor.index_version = ParseHex<uint64_t>(in);
+    cursor.query_hash = ParseHex<uint64_t>(in);
+    cursor.first_page_size = ParseHex<uint64_t>(in);
+    cursor.page_count = ParseHex<uint64_t>(in);
+    cursor.relevance = ParseHex<double>(in);
+    cursor.rating = ParseHex<int>(in);
+    cursor.document_id = ParseHex<int>(in);
+    return cursor;
+}
+
+uint64_t HashQuery(string_view raw_query, DocumentStatus status) {
+    return hash<string_view>{}(raw_query) * 31 + static_cast<uint64_t>(status);
+}
+
+// Strict weak order of the pages after the first one: relevance, rating, then id, without the 1e-6
+// tolerance of HasHigherRank. Near ties do not compare transitively under the tolerance, so a page
+// boundary by HasHigherRank would skip or repeat documents of a chain of near ties
+bool PrecedesOnLaterPage(const Document& lhs, const Document& rhs) {
+    if (lhs.relevance != rhs.relevance) {
+        return lhs.relevance > rhs.relevance;
+    }
+    if (lhs.rating != rhs.rating) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.id < rhs.id;
+}
+
+// The page_size best documents by HasHigherRank, best first, selected with a heap whose front is the worst
+// document of the page. Offered in id order like the documents of FindTopDocuments, so the page is
+// selected exactly as FindTopDocuments selects its top documents
+vector<Document> SelectFirstPage(const vector<Document>& documents, size_t page_size) {
+    vector<Document> heap;
+    heap.reserve(min(page_size, documents.size()) + 1);
+    for (const Document& document : documents) {
+        if (heap.size() < page_size) {
+            heap.push_back(document);
+            push_heap(heap.begin(), heap.end(), HasHigherRank);
+        }
+        else if (HasHigherRank(document, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), HasHigherRank);
+            heap.back() = document;
+            push_heap(heap.begin(), heap.end(), HasHigherRank);
+        }
+    }
+    sort_heap(heap.begin(), heap.end(), HasHigherRank);
+    return heap;
+}
+
+} // namespace
+
+size_t PaginatedSearch::Snapshot::GetMemoryUsage() const {
+    size_t bytes = sizeof(Snapshot) + raw_query.capacity() + documents.capacity() * sizeof(Document);
+    for (const auto& [first_page_size, pages] : later_pages) {
+        bytes += sizeof(LaterPages) + pages->order.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+PaginatedSearch::PaginatedSearch(const SearchServer& search_server, size_t max_snapshots, size_t max_cache_bytes)
+    : search_server_(search_server)
+    , max_snapshots_(max<size_t>(max_snapshots, 1))
+    , max_cache_bytes_(max_cache_bytes) {
+}
+
+SearchPage PaginatedSearch::FindPage(string_view raw_query, DocumentStatus status, size_t page_size, string_view cursor) {
+    if (page_size == 0) {
+        throw invalid_argument("Page size must be positive");
+    }
+
+    const uint64_t query_hash = HashQuery(raw_query, status);
+    SearchPage result;
+    size_t remaining = 0;
+    shared_ptr<const Snapshot> snapshot;
+    SearchCursor next;
+    if (cursor.empty()) {
+        snapshot = FindSnapshot(raw_query, status, search_server_.GetIndexVersion());
+        if (snapshot == nullptr) {
+            snapshot = PinSnapshot(raw_query, status, 0);
+        }
+        result.documents = SelectFirstPage(snapshot->documents, page_size);
+        remaining = snapshot->documents.size() - result.documents.size();
+        next.first_page_size = page_size;
+        next.page_count = 1;
+    }
+    else {
+        const SearchCursor parsed = DecodeSearchCursor(cursor);
+        if (parsed.query_hash != query_hash) {
+            throw invalid_argument("Search cursor belongs to another query");
+        }
+        if (parsed.first_page_size == 0 || parsed.page_count == 0) {
+            throw invalid_argument("Invalid search cursor");
+        }
+        snapshot = FindSnapshot(parsed.snapshot_id);
+        if (snapshot == nullptr) {
+            // An evicted snapshot can be rebuilt only while the index is the same as when it was taken
+            if (parsed.index_version != search_server_.GetIndexVersion()) {
+                throw runtime_error("Search cursor has expired");
+            }
+            snapshot = PinSnapshot(raw_query, status, parsed.snapshot_id);
+        }
+        const Document position(parsed.document_id, parsed.relevance, parsed.rating);
+
+        const auto later_pages = GetLaterPages(snapshot, parsed.first_page_size);
+        const vector<Document>& documents = snapshot->documents;
+        const vector<uint32_t>& order = later_pages->order;
+        const auto same_position = [&position](const Document& document) {
+            return document.id == position.id && document.relevance == position.relevance && document.rating == position.rating;
+        };
+        size_t first = 0;
+        if (parsed.page_count == 1) {
+            if (!same_position(later_pages->first_page_last)) {
+                throw invalid_argument("Invalid search cursor");
+            }
+        }
+        else {
+            first = static_cast<size_t>(partition_point(order.begin(), order.end(), [&](uint32_t index) {
+                return !PrecedesOnLaterPage(position, documents[index]);
+            }) - order.begin());
+            if (first == 0 || !same_position(documents[order[first - 1]])) {
+                throw invalid_argument("Invalid search cursor");
+            }
+        }
+        const size_t end = first + min(page_size, order.size() - first);
+        for (size_t i = first; i < end; ++i) {
+            result.documents.push_back(documents[order[i]]);
+        }
+        remaining = order.size() - end;
+        next.first_page_size = parsed.first_page_size;
+        next.page_count = parsed.page_count + 1;
+    }
+
+    if (remaining > 0) {
+        const Document& last = result.documents.back();
+        next.snapshot_id = snapshot->id;
+        next.index_version = snapshot->index_version;
+        next.query_hash = query_hash;
+        next.relevance = last.relevance;
+        next.rating = last.rating;
+        next.document_id = last.id;
+        result.next_cursor = EncodeSearchCursor(next);
+    }
+    return result;
+}
+
+SearchPage PaginatedSearch::FindPage(string_view raw_query, size_t page_size, string_view cursor) {
+    return FindPage(raw_query, DocumentStatus::ACTUAL, page_size, cursor);
+}
+
+size_t PaginatedSearch::GetCacheMemoryUsage() {
+    lock_guard<mutex> guard(mutex_);
+    return cache_bytes_;
+}
+
+shared_ptr<const PaginatedSearch::Snapshot> PaginatedSearch::PinSnapshot(string_view raw_query, DocumentStatus status, uint64_t snapshot_id) {
+    auto snapshot = make_shared<Snapshot>();
+    snapshot->index_version = search_server_.GetIndexVersion();
+    snapshot->raw_query = string(raw_query);
+    snapshot->status = status;
+    // FindMatchedDocuments returns the documents in id order
+    snapshot->documents = search_server_.FindMatchedDocuments(raw_query, status);
+
+    lock_guard<mutex> guard(mutex_);
+    snapshot->id = snapshot_id == 0 ? next_snapshot_id_++ : snapshot_id;
+    if (const auto existing = snapshot_index_.find(snapshot->id); existing != snapshot_index_.end()) {
+        cache_bytes_ -= (*existing->second)->GetMemoryUsage();
+        snapshots_.erase(existing->second);
+        snapshot_index_.erase(existing);
+    }
+    snapshots_.push_front(snapshot);
+    snapshot_index_[snapshot->id] = snapshots_.begin();
+    cache_bytes_ += snapshot->GetMemoryUsage();
+    EvictSnapshots();
+    return snapshot;
+}
+
+shared_ptr<const PaginatedSearch::Snapshot> PaginatedSearch::FindSnapshot(uint64_t snapshot_id) {
+    lock_guard<mutex> guard(mutex_);
+    const auto it = snapshot_index_.find(snapshot_id);
+    if (it == snapshot_index_.end()) {
+        return nullptr;
+    }
+    snapshots_.splice(snapshots_.begin(), snapshots_, it->second);
+    return *it->second;
+}
+
+shared_ptr<const PaginatedSearch::Snapshot> PaginatedSearch::FindSnapshot(string_view raw_query, DocumentStatus status, uint64_t index_version) {
+    lock_guard<mutex> guard(mutex_);
+    const auto it = find_if(snapshots_.begin(), snapshots_.end(), [raw_query, status, index_version](const auto& snapshot) {
+        return snapshot->index_version == index_version && snapshot->status == status && snapshot->raw_query == raw_query;
+    });
+    if (it == snapshots_.end()) {
+        return nullptr;
+    }
+    snapshots_.splice(snapshots_.begin(), snapshots_, it);
+    return *snapshots_.begin();
+}
+
+shared_ptr<const PaginatedSearch::LaterPages> PaginatedSearch::GetLaterPages(const shared_ptr<const Snapshot>& snapshot, size_t first_page_size) {
+    {
+        lock_guard<mutex> guard(mutex_);
+        if (const auto it = snapshot->later_pages.find(first_page_size); it != snapshot->later_pages.end()) {
+            return it->second;
+        }
+    }
+
+    // Ranked outside the lock. Two threads may rank the same pages, the first one to finish keeps them
+    const vector<Document>& documents = snapshot->documents;
+    vector<Document> first_page = SelectFirstPage(documents, first_page_size);
+    if (first_page.empty()) {
+        throw invalid_argument("Invalid search cursor");
+    }
+    auto pages = make_shared<LaterPages>();
+    pages->first_page_last = first_page.back();
+    sort(first_page.begin(), first_page.end(), [](const Document& lhs, const Document& rhs) {
+        return lhs.id < rhs.id;
+    });
+    // Both are in id order, so the first page is left out by a merge
+    pages->order.reserve(documents.size() - first_page.size());
+    auto first_page_it = first_page.begin();
+    for (size_t i = 0; i < documents.size(); ++i) {
+        if (first_page_it != first_page.end() && first_page_it->id == documents[i].id) {
+            ++first_page_it;
+            continue;
+        }
+        pages->order.push_back(static_cast<uint32_t>(i));
+    }
+    sort(pages->order.begin(), pages->order.end(), [&documents](uint32_t lhs, uint32_t rhs) {
+        return PrecedesOnLaterPage(documents[lhs], documents[rhs]);
+    });
+
+    lock_guard<mutex> guard(mutex_);
+    const auto [it, inserted] = snapshot->later_pages.emplace(first_page_size, move(pages));
+    // Pages added to an evicted snapshot are not counted: its bytes left the total when it was dropped
+    const auto cached = snapshot_index_.find(snapshot->id);
+    if (inserted && cached != snapshot_index_.end() && *cached->second == snapshot) {
+        cache_bytes_ += sizeof(LaterPages) + it->second->order.capacity() * sizeof(uint32_t);
+        EvictSnapshots();
+    }
+    return it->second;
+}
+
+void PaginatedSearch::EvictSnapshots() {
+    while (snapshots_.size() > 1 && (snapshots_.size() > max_snapshots_ || cache_bytes_ > max_cache_bytes_)) {
+        cache_bytes_ -= snapshots_.back()->GetMemoryUsage();
+        snapshot_index_.erase(snapshots_.back()->id);
+        snapshots_.pop_back();
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+struct SearchPage {
+    std::vector<Document> documents;
+    // Opaque position after the last document of the page, empty on the last page
+    std::string next_cursor;
+};
+
+// Pages through all results of a query. The first page scores the query once and pins the matched
+// documents as a snapshot, so documents added or removed between page requests do not shift the pages.
+// First pages of the same query and status reuse the snapshot while the index is unchanged.
+// The first page scans the snapshot with a heap of page_size documents, by HasHigherRank in id order like
+// FindTopDocuments, so it starts with the documents of FindTopDocuments. The second page ranks the rest of
+// the snapshot once in exact relevance, rating and id order and keeps that order in the snapshot. Every
+// later page is a binary search for the last document of the previous page, held by the cursor, so no
+// page skips or repeats a document. Writes are isolated only between calls: safe to call from several
+// threads as long as nobody modifies the search server at the same time.
+class PaginatedSearch {
+public:
+    // Least recently used snapshots are dropped beyond either limit, the snapshot in use is always kept
+    explicit PaginatedSearch(const SearchServer& search_server, size_t max_snapshots = 64, size_t max_cache_bytes = 64u << 20);
+
+    // An empty cursor starts from the first page. A cursor must come from the same query and status
+    SearchPage FindPage(std::string_view raw_query, DocumentStatus status, size_t page_size, std::string_view cursor = {});
+    SearchPage FindPage(std::string_view raw_query, size_t page_size, std::string_view cursor = {});
+
+    // Bytes held by the pinned snapshots
+    size_t GetCacheMemoryUsage();
+
+private:
+    struct LaterPages {
+        Document first_page_last;
+        std::vector<uint32_t> order;
+    };
+
+    struct Snapshot {
+        uint64_t id;
+        uint64_t index_version;
+        std::string raw_query;
+        DocumentStatus status;
+        // Every matched document, unranked in id order
+        std::vector<Document> documents;
+        // Indexes of the documents after a first page of the key size, in the order of the later pages.
+        // Guarded by the mutex of PaginatedSearch
+        mutable std::map<size_t, std::shared_ptr<const LaterPages>> later_pages;
+
+        size_t GetMemoryUsage() const;
+    };
+
+    const SearchServer& search_server_;
+    const size_t max_snapshots_;
+    const size_t max_cache_bytes_;
+
+    std::mutex mutex_;
+    uint64_t next_snapshot_id_ = 1;
+    size_t cache_bytes_ = 0;
+    // Most recently used snapshot first
+    std::list<std::shared_ptr<const Snapshot>> snapshots_;
+    std::map<uint64_t, std::list<std::shared_ptr<const Snapshot>>::iterator> snapshot_index_;
+
+    std::shared_ptr<const Snapshot> PinSnapshot(std::string_view raw_query, DocumentStatus status, uint64_t snapshot_id);
+    std::shared_ptr<const Snapshot> FindSnapshot(uint64_t snapshot_id);
+    std::shared_ptr<const Snapshot> FindSnapshot(std::string_view raw_query, DocumentStatus status, uint64_t index_version);
+    std::shared_ptr<const LaterPages> GetLaterPages(const std::shared_ptr<const Snapshot>& snapshot, size_t first_page_size);
+    // Drops the least recently used snapshots beyond the limits, the most recent one stays
+    void EvictSnapshots();
+};
@@ -0,0 +1,262 @@
+#include "partition_protocol.h"
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// Upper bound on a single frame, guards against reading garbage as a length
+const uint32_t kMaxFrameSize = 64u << 20;
+
+class PayloadWriter {
+public:
+    void PutU8(uint8_t value) {
+        data_.push_back(static_cast<char>(value));
+    }
+
+    void PutU32(uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            PutU8(static_cast<uint8_t>(value >> shift));
+        }
+    }
+
+    void PutI32(int32_t value) {
+        PutU32(static_cast<uint32_t>(value));
+    }
+
+    void PutDouble(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        PutU32(static_cast<uint32_t>(bits));
+        PutU32(static_cast<uint32_t>(bits >> 32));
+    }
+
+    void PutString(string_view value) {
+        PutU32(static_cast<uint32_t>(value.size()));
+        data_.append(value.data(), value.size());
+    }
+
+    string Finish(MessageType type) const {
+        PayloadWriter frame;
+        frame.PutU32(static_cast<uint32_t>(data_.size() + 1));
+        frame.PutU8(static_cast<uint8_t>(type));
+        frame.data_ += data_;
+        return move(frame.data_);
+    }
+
+private:
+    string data_;
+};
+
+class PayloadReader {
+public:
+    explicit PayloadReader(string_view data) : data_(data) {
+    }
+
+    uint8_t GetU8() {
+        Require(1);
+        const auto value = static_cast<uint8_t>(data_[0]);
+        data_.remove_prefix(1);
+        return value;
+    }
+
+    uint32_t GetU32() {
+        Require(4);
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(static_cast<uint8_t>(data_[i])) << (8 * i);
+        }
+        data_.remove_prefix(4);
+        return value;
+    }
+
+    int32_t GetI32() {
+        return static_cast<int32_t>(GetU32());
+    }
+
+    double GetDouble() {
+        const uint64_t low = GetU32();
+        const uint64_t high = GetU32();
+        const uint64_t bits = low | (high << 32);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    string GetString() {
+        const uint32_t size = GetU32();
+        Require(size);
+        string value(data_.substr(0, size));
+        data_.remove_prefix(size);
+        return value;
+    }
+
+    void ExpectEnd() const {
+        if (!data_.empty()) {
+            throw runtime_error("Trailing bytes in message payload");
+        }
+    }
+
+private:
+    void Require(size_t size) const {
+        if (data_.size() < size) {
+            throw runtime_error("Truncated message payload");
+        }
+    }
+
+    string_view data_;
+};
+
+void ExpectType(const Message& message, MessageType type) {
+    if (message.type == MessageType::ERROR_RESPONSE && type != MessageType::ERROR_RESPONSE) {
+        throw runtime_error("Partition error: " + DecodeErrorResponse(message));
+    }
+    if (message.type != type) {
+        throw runtime_error("Unexpected message type " + to_string(static_cast<int>(message.type)));
+    }
+}
+
+void PutStatistics(PayloadWriter& writer, const CorpusStatistics& statistics) {
+    writer.PutI32(statistics.document_count);
+    writer.PutU32(static_cast<uint32_t>(statistics.document_freqs.size()));
+    for (const auto& [word, document_freq] : statistics.document_freqs) {
+        writer.PutString(word);
+        writer.PutI32(document_freq);
+    }
+}
+
+CorpusStatistics GetStatistics(PayloadReader& reader) {
+    CorpusStatistics statistics;
+    statistics.document_count = reader.GetI32();
+    const uint32_t word_count = reader.GetU32();
+    for (uint32_t i = 0; i < word_count; ++i) {
+        string word = reader.GetString();
+        statistics.document_freqs[move(word)] = reader.GetI32();
+    }
+    return statistics;
+}
+
+} // namespace
+
+string EncodeStatsRequest(string_view raw_query) {
+    PayloadWriter writer;
+    writer.PutString(raw_query);
+    return writer.Finish(MessageType::STATS_REQUEST);
+}
+
+string EncodeStatsResponse(const CorpusStatistics& statistics) {
+    PayloadWriter writer;
+    PutStatistics(writer, statistics);
+    return writer.Finish(MessageType::STATS_RESPONSE);
+}
+
+string EncodeSearchRequest(const SearchRequest& request) {
+    PayloadWriter writer;
+    writer.PutString(request.raw_query);
+    writer.PutU8(static_cast<uint8_t>(request.status));
+    PutStatistics(writer, request.global_statistics);
+    return writer.Finish(MessageType::SEARCH_REQUEST);
+}
+
+string EncodeSearchResponse(const vector<Document>& documents) {
+    PayloadWriter writer;
+    writer.PutU32(static_cast<uint32_t>(documents.size()));
+    for (const Document& document : documents) {
+        writer.PutI32(document.id);
+        writer.PutDouble(document.relevance);
+        writer.PutI32(document.rating);
+    }
+    return writer.Finish(MessageType::SEARCH_RESPONSE);
+}
+
+string EncodeErrorResponse(string_view error) {
+    PayloadWriter writer;
+    writer.PutString(error);
+    return writer.Finish(MessageType::ERROR_RESPONSE);
+}
+
+string DecodeStatsRequest(const Message& message) {
+    ExpectType(message, MessageType::STATS_REQUEST);
+    PayloadReader reader(message.payload);
+    string raw_query = reader.GetString();
+    reader.ExpectEnd();
+    return raw_query;
+}
+
+CorpusStatistics DecodeStatsResponse(const Message& message) {
+    ExpectType(message, MessageType::STATS_RESPONSE);
+    PayloadReader reader(message.payload);
+    auto statistics = GetStatistics(reader);
+    reader.ExpectEnd();
+    return statistics;
+}
+
+SearchRequest DecodeSearchRequest(const Message& message) {
+    ExpectType(message, MessageType::SEARCH_REQUEST);
+    PayloadReader reader(message.payload);
+    SearchRequest request;
+    request.raw_query = reader.GetString();
+    const uint8_t status = reader.GetU8();
+    if (status > static_cast<uint8_t>(DocumentStatus::REMOVED)) {
+        throw runtime_error("Invalid document status " + to_string(status));
+    }
+    request.status = static_cast<DocumentStatus>(status);
+    request.global_statistics = GetStatistics(reader);
+    reader.ExpectEnd();
+    return request;
+}
+
+vector<Document> DecodeSearchResponse(const Message& message) {
+    ExpectType(message, MessageType::SEARCH_RESPONSE);
+    PayloadReader reader(message.payload);
+    const uint32_t document_count = reader.GetU32();
+    vector<Document> documents;
+    for (uint32_t i = 0; i < document_count; ++i) {
+        Document document;
+        document.id = reader.GetI32();
+        document.relevance = reader.GetDouble();
+        document.rating = reader.GetI32();
+        documents.push_back(document);
+    }
+    reader.ExpectEnd();
+    return documents;
+}
+
+string DecodeErrorResponse(const Message& message) {
+    ExpectType(message, MessageType::ERROR_RESPONSE);
+    PayloadReader reader(message.payload);
+    return reader.GetString();
+}
+
+void FrameReader::Append(const char* data, size_t size) {
+    if (read_pos_ > 0) {
+        buffer_.erase(0, read_pos_);
+        read_pos_ = 0;
+    }
+    buffer_.append(data, size);
+}
+
+optional<Message> FrameReader::Next() {
+    string_view pending(buffer_);
+    pending.remove_prefix(read_pos_);
+    if (pending.size() < 4) {
+        return nullopt;
+    }
+    const uint32_t frame_size = PayloadReader(pending).GetU32();
+    if (frame_size == 0 || frame_size > kMaxFrameSize) {
+        throw runtime_error("Invalid frame size " + to_string(frame_size));
+    }
+    if (pending.size() < 4 + frame_size) {
+        return nullopt;
+    }
+    Message message{ static_cast<MessageType>(pending[4]), string(pending.substr(5, frame_size - 1)) };
+    read_pos_ += 4 + frame_size;
+    return message;
+}
+
+void FrameReader::Clear() {
+    buffer_.clear();
+    read_pos_ = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+// Binary request/response protocol between the query router and partition workers.
+// Every frame is a little-endian uint32 length, a MessageType byte and the payload.
+// Strings are a uint32 length followed by the bytes.
+
+enum class MessageType : uint8_t {
+    STATS_REQUEST = 1,
+    STATS_RESPONSE,
+    SEARCH_REQUEST,
+    SEARCH_RESPONSE,
+    ERROR_RESPONSE,
+};
+
+struct Message {
+    MessageType type;
+    std::string payload;
+};
+
+struct SearchRequest {
+    std::string raw_query;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    CorpusStatistics global_statistics;
+};
+
+std::string EncodeStatsRequest(std::string_view raw_query);
+std::string EncodeStatsResponse(const CorpusStatistics& statistics);
+std::string EncodeSearchRequest(const SearchRequest& request);
+std::string EncodeSearchResponse(const std::vector<Document>& documents);
+std::string EncodeErrorResponse(std::string_view error);
+
+// Decoders throw std::runtime_error on malformed payloads
+std::string DecodeStatsRequest(const Message& message);
+CorpusStatistics DecodeStatsResponse(const Message& message);
+SearchRequest DecodeSearchRequest(const Message& message);
+std::vector<Document> DecodeSearchResponse(const Message& message);
+std::string DecodeErrorResponse(const Message& message);
+
+// Accumulates bytes read from a stream socket and cuts them into frames
+class FrameReader {
+public:
+    void Append(const char* data, size_t size);
+    std::optional<Message> Next();
+    void Clear();
+
+private:
+    std::string buffer_;
+    size_t read_pos_ = 0;
+};
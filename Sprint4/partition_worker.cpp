@@ -0,0 +1,162 @@
+#include "partition_worker.h"
+
+#include <cerrno>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// 0 when the platform gives no cheap way to count them
+size_t CountProcessThreads() {
+#ifdef __linux__
+    error_code error;
+    filesystem::directory_iterator tasks("/proc/self/task", error);
+    if (!error) {
+        return static_cast<size_t>(distance(tasks, filesystem::directory_iterator()));
+    }
+#endif
+    return 0;
+}
+
+} // namespace
+
+PartitionWorker::PartitionWorker(const SearchServer& search_server, PartitionEndpoint endpoint)
+    : search_server_(search_server)
+    , endpoint_(move(endpoint))
+    , listener_(ListenOn(endpoint_)) {
+}
+
+const PartitionEndpoint& PartitionWorker::GetEndpoint() const {
+    return endpoint_;
+}
+
+string PartitionWorker::HandleMessage(const Message& message) const {
+    try {
+        switch (message.type) {
+        case MessageType::STATS_REQUEST:
+            return EncodeStatsResponse(search_server_.GetQueryStatistics(DecodeStatsRequest(message)));
+        case MessageType::SEARCH_REQUEST: {
+            const auto request = DecodeSearchRequest(message);
+            return EncodeSearchResponse(search_server_.FindTopDocuments(request.raw_query, request.status, request.global_statistics));
+        }
+        default:
+            return EncodeErrorResponse("Unsupported request type " + to_string(static_cast<int>(message.type)));
+        }
+    }
+    catch (const exception& e) {
+        return EncodeErrorResponse(e.what());
+    }
+}
+
+void PartitionWorker::Serve() {
+    struct Client {
+        Socket socket;
+        FrameReader reader;
+    };
+    map<int, Client> clients;
+    vector<pollfd> descriptors;
+    char buffer[64 * 1024];
+
+    while (true) {
+        descriptors.clear();
+        descriptors.push_back({ listener_.Get(), POLLIN, 0 });
+        for (const auto& [fd, client] : clients) {
+            descriptors.push_back({ fd, POLLIN, 0 });
+        }
+        if (poll(descriptors.data(), descriptors.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw runtime_error("poll failed in partition worker");
+        }
+
+        if (descriptors[0].revents & POLLIN) {
+            Socket connection = AcceptConnection(listener_);
+            const int fd = connection.Get();
+            clients[fd].socket = move(connection);
+        }
+
+        for (size_t i = 1; i < descriptors.size(); ++i) {
+            if (descriptors[i].revents == 0) {
+                continue;
+            }
+            Client& client = clients.at(descriptors[i].fd);
+            const ssize_t received = recv(descriptors[i].fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                if (received < 0 && errno == EINTR) {
+                    continue;
+                }
+                clients.erase(descriptors[i].fd);
+                continue;
+            }
+
+            bool keep = true;
+            try {
+                client.reader.Append(buffer, static_cast<size_t>(received));
+                while (auto message = client.reader.Next()) {
+                    const auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+                    if (!SendAll(client.socket, HandleMessage(*message), deadline)) {
+                        keep = false;
+                        break;
+                    }
+                }
+            }
+            catch (const exception& e) {
+                cerr << "Partition worker " << endpoint_ << " dropped a client: " << e.what() << endl;
+                keep = false;
+            }
+            if (!keep) {
+                clients.erase(descriptors[i].fd);
+            }
+        }
+    }
+}
+
+pid_t SpawnPartitionWorker(const SearchServer& partition, PartitionEndpoint& endpoint) {
+    // A lock held by another thread at fork() stays locked in the child forever, malloc and iostreams included
+    if (CountProcessThreads() > 1) {
+        throw logic_error("Partition workers must be spawned before the process starts other threads");
+    }
+    // Bind in the parent: the endpoint is connectable as soon as this function returns
+    PartitionWorker worker(partition, endpoint);
+    endpoint = worker.GetEndpoint();
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        throw runtime_error("fork failed for partition worker");
+    }
+    if (pid == 0) {
+        signal(SIGPIPE, SIG_IGN);
+        try {
+            worker.Serve();
+        }
+        catch (const exception& e) {
+            cerr << "Partition worker " << endpoint << " failed: " << e.what() << endl;
+        }
+        _exit(1);
+    }
+    return pid;
+}
+
+void StopPartitionWorker(pid_t pid, const PartitionEndpoint& endpoint) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    if (endpoint.kind == PartitionEndpoint::Kind::UNIX) {
+        unlink(endpoint.path.c_str());
+    }
+}
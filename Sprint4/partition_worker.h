@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+
+#include <sys/types.h>
+
+#include "local_socket.h"
+#include "partition_protocol.h"
+#include "search_server.h"
+
+// Serves one partition of the corpus to the query router over the partition protocol
+class PartitionWorker {
+public:
+    // Binds the endpoint right away, so clients may connect as soon as the constructor returns
+    PartitionWorker(const SearchServer& search_server, PartitionEndpoint endpoint);
+
+    const PartitionEndpoint& GetEndpoint() const;
+
+    // Handles connections one request at a time until the process is terminated
+    [[noreturn]] void Serve();
+
+    std::string HandleMessage(const Message& message) const;
+
+private:
+    const SearchServer& search_server_;
+    PartitionEndpoint endpoint_;
+    Socket listener_;
+};
+
+// Forks a worker process serving the partition. For TCP port 0 the endpoint gets the chosen port.
+// The child keeps only the calling thread and runs without exec, so workers must be spawned before
+// the process starts any other thread: pools, parallel algorithms, writers. Throws std::logic_error
+// where the thread count can be checked (Linux) and more than one thread runs
+pid_t SpawnPartitionWorker(const SearchServer& partition, PartitionEndpoint& endpoint);
+// Terminates the worker and removes its Unix socket file
+void StopPartitionWorker(pid_t pid, const PartitionEndpoint& endpoint);
@@ -2,9 +2,22 @@
 #include "process_queries.h"
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries) {
+    // Calibrated here, before the query tasks: a calibration started by one of them would fork onto the pool they occupy
+    ExecutionTuner::Instance().CalibrateOnce();
     std::vector<std::vector<Document>> res(queries.size());
-    std::transform(std::execution::par, queries.begin(), queries.end(), res.begin(), [&search_server](const std::string& query) {
-        return search_server.FindTopDocuments(query);
+    // Queries run as tasks of the work-stealing pool and may fork further on the same pool
+    Transform(search_execution::work_stealing, queries.begin(), queries.end(), res.begin(), [&search_server](const std::string& query) {
+        return search_server.FindTopDocuments(search_execution::adaptive, query);
+        });
+
+    return res;
+}
+
+std::vector<SearchResult> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries, const SearchBudget& budget) {
+    ExecutionTuner::Instance().CalibrateOnce();
+    std::vector<SearchResult> res(queries.size());
+    Transform(search_execution::work_stealing, queries.begin(), queries.end(), res.begin(), [&search_server, &budget](const std::string& query) {
+        return search_server.FindTopDocuments(search_execution::adaptive, query, budget);
         });
 
     return res;
@@ -8,4 +8,6 @@
 #include<execution>
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries);
+// Searches every query within the budget. A deadline is shared by the whole batch, a posting limit applies to each query
+std::vector<SearchResult> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries, const SearchBudget& budget);
 std::vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
\ No newline at end of file
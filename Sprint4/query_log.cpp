@@ -0,0 +1,135 @@
+#include "query_log.h"
+
+#include <iterator>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const uint32_t kQueryLogMagic = 0x474C5152;
+const uint32_t kQueryLogVersion = 1;
+// Status byte of the requests with a custom predicate
+const uint8_t kPredicateRequest = 0xFF;
+
+void PutU32(string& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<char>(value >> shift));
+    }
+}
+
+// Seven bits per byte, the high bit set on every byte but the last
+void PutVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Readers return nullopt when the log ends in the middle of a value
+optional<uint32_t> GetU32(string_view& in) {
+    if (in.size() < 4) {
+        return nullopt;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+    }
+    in.remove_prefix(4);
+    return value;
+}
+
+optional<uint64_t> GetVarint(string_view& in) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < in.size(); ++i) {
+        if (i == 10) {
+            throw runtime_error("Corrupt query log");
+        }
+        const uint8_t byte = static_cast<uint8_t>(in[i]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            in.remove_prefix(i + 1);
+            return value;
+        }
+    }
+    return nullopt;
+}
+
+} // namespace
+
+QueryLogWriter::QueryLogWriter(ostream& out)
+    : out_(out)
+    , start_(chrono::steady_clock::now()) {
+    const auto start_time = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    string header;
+    PutU32(header, kQueryLogMagic);
+    PutU32(header, kQueryLogVersion);
+    PutU32(header, static_cast<uint32_t>(start_time));
+    PutU32(header, static_cast<uint32_t>(static_cast<uint64_t>(start_time) >> 32));
+    out_.write(header.data(), header.size());
+}
+
+void QueryLogWriter::Write(string_view raw_query, optional<DocumentStatus> status) {
+    lock_guard<mutex> guard(mutex_);
+    // Taken under the lock, so that the times of the records never decrease
+    const auto time = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start_);
+    string record;
+    PutVarint(record, static_cast<uint64_t>((time - last_time_).count()));
+    record.push_back(status ? static_cast<char>(*status) : static_cast<char>(kPredicateRequest));
+    PutVarint(record, raw_query.size());
+    record += raw_query;
+    out_.write(record.data(), record.size());
+    if (!out_) {
+        throw runtime_error("Failed to write query log");
+    }
+    last_time_ = time;
+    ++record_count_;
+}
+
+size_t QueryLogWriter::GetRecordCount() const {
+    lock_guard<mutex> guard(mutex_);
+    return record_count_;
+}
+
+QueryLog ReadQueryLog(istream& in) {
+    const string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    string_view rest = contents;
+    const auto magic = GetU32(rest);
+    const auto version = GetU32(rest);
+    const auto start_low = GetU32(rest);
+    const auto start_high = GetU32(rest);
+    if (!magic || *magic != kQueryLogMagic || !version || *version != kQueryLogVersion || !start_high) {
+        throw runtime_error("Not a query log");
+    }
+    QueryLog log;
+    log.start_time = chrono::system_clock::time_point(chrono::duration_cast<chrono::system_clock::duration>(
+        chrono::microseconds(static_cast<int64_t>(*start_low | (static_cast<uint64_t>(*start_high) << 32)))));
+
+    chrono::microseconds time{ 0 };
+    while (!rest.empty()) {
+        const auto delay = GetVarint(rest);
+        if (!delay || rest.empty()) {
+            break;
+        }
+        const uint8_t status = static_cast<uint8_t>(rest[0]);
+        rest.remove_prefix(1);
+        if (status != kPredicateRequest && status > static_cast<uint8_t>(DocumentStatus::REMOVED)) {
+            throw runtime_error("Corrupt query log");
+        }
+        const auto size = GetVarint(rest);
+        if (!size || rest.size() < *size) {
+            break;
+        }
+        time += chrono::microseconds(*delay);
+        QueryLogRecord record;
+        record.time = time;
+        if (status != kPredicateRequest) {
+            record.status = static_cast<DocumentStatus>(status);
+        }
+        record.raw_query = string(rest.substr(0, *size));
+        rest.remove_prefix(*size);
+        log.records.push_back(move(record));
+    }
+    return log;
+}
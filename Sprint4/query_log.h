@@ -0,0 +1,48 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+// A search request as it arrived
+struct QueryLogRecord {
+    // Since the log was started
+    std::chrono::microseconds time{ 0 };
+    // Empty for requests filtered by a custom predicate, which cannot be recorded
+    std::optional<DocumentStatus> status;
+    std::string raw_query;
+};
+
+struct QueryLog {
+    // Wall clock time when the log was started
+    std::chrono::system_clock::time_point start_time;
+    std::vector<QueryLogRecord> records;
+};
+
+// Appends requests to a binary query log: a header with the start time, then per request the
+// microseconds since the previous one as a varint, a status byte, the query length as a varint
+// and the query. Requests from several threads may share a writer
+class QueryLogWriter {
+public:
+    explicit QueryLogWriter(std::ostream& out);
+
+    void Write(std::string_view raw_query, std::optional<DocumentStatus> status);
+    size_t GetRecordCount() const;
+
+private:
+    std::ostream& out_;
+    const std::chrono::steady_clock::time_point start_;
+    std::chrono::microseconds last_time_{ 0 };
+    size_t record_count_ = 0;
+    mutable std::mutex mutex_;
+};
+
+// Throws std::runtime_error for a stream that is not a query log. A record cut short,
+// as left by a process that stopped while writing, ends the log
+QueryLog ReadQueryLog(std::istream& in);
@@ -0,0 +1,81 @@
+#include "query_plan.h"
+
+using namespace std;
+
+namespace {
+
+// A bitset spends one bit per id of the range, a sorted list 32 bits per excluded id
+const size_t kMaxBitsPerExcludedId = 32;
+const size_t kMinBitsetRange = 4096;
+
+} // namespace
+
+DocumentExclusionSet::DocumentExclusionSet(vector<int> document_ids) {
+    sort(document_ids.begin(), document_ids.end());
+    document_ids.erase(unique(document_ids.begin(), document_ids.end()), document_ids.end());
+    if (document_ids.empty()) {
+        return;
+    }
+    first_ = document_ids.front();
+    last_ = document_ids.back();
+    size_ = document_ids.size();
+
+    const size_t range = static_cast<size_t>(last_ - first_) + 1;
+    if (range > max(kMinBitsetRange, size_ * kMaxBitsPerExcludedId)) {
+        sparse_ids_ = move(document_ids);
+        return;
+    }
+    bits_.assign((range + 63) / 64, 0);
+    for (const int document_id : document_ids) {
+        const size_t offset = static_cast<size_t>(document_id - first_);
+        bits_[offset / 64] |= uint64_t(1) << (offset % 64);
+    }
+}
+
+size_t DocumentExclusionSet::GetSize() const {
+    return size_;
+}
+
+bool DocumentExclusionSet::IsEmpty() const {
+    return size_ == 0;
+}
+
+bool DocumentExclusionSet::IsBitset() const {
+    return !bits_.empty();
+}
+
+int DocumentExclusionSet::GetFirst() const {
+    return first_;
+}
+
+int DocumentExclusionSet::GetLast() const {
+    return last_;
+}
+
+bool QueryPlan::CanMatch() const {
+    return !plus_terms.empty();
+}
+
+ostream& operator<<(ostream& out, const QueryPlan& plan) {
+    if (!plan.CanMatch()) {
+        out << "no plus term is present in the index, nothing can match" << endl;
+    }
+    else {
+        out << plan.plus_terms.size() << " plus terms, " << plan.candidate_postings << " candidate postings" << endl;
+    }
+    for (const PlannedTerm& term : plan.plus_terms) {
+        out << "  plus " << term.word << ": " << term.postings->size() << " postings, idf " << term.inverse_document_freq << endl;
+    }
+    for (const PlannedTerm& term : plan.minus_terms) {
+        out << "  minus " << term.word << ": " << term.postings->size() << " postings" << endl;
+    }
+    for (const string& word : plan.dropped_words) {
+        out << "  dropped " << word << endl;
+    }
+    if (!plan.excluded_documents.IsEmpty()) {
+        out << "  excluded " << plan.excluded_documents.GetSize() << " documents as a "
+            << (plan.excluded_documents.IsBitset() ? "bitset" : "sorted list") << " over ids ["
+            << plan.excluded_documents.GetFirst() << ", " << plan.excluded_documents.GetLast() << "]" << endl;
+    }
+    return out;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "term_frequency.h"
+
+// Documents excluded by the minus words of a query. Stored as a bitset over the range
+// between the smallest and the largest excluded id, or as a sorted id list when the ids
+// are too sparse for a bitset to pay off
+class DocumentExclusionSet {
+public:
+    DocumentExclusionSet() = default;
+    explicit DocumentExclusionSet(std::vector<int> document_ids);
+
+    bool Contains(int document_id) const {
+        if (document_id < first_ || document_id > last_) {
+            return false;
+        }
+        if (!bits_.empty()) {
+            const size_t offset = static_cast<size_t>(document_id - first_);
+            return (bits_[offset / 64] >> (offset % 64)) & 1;
+        }
+        return std::binary_search(sparse_ids_.begin(), sparse_ids_.end(), document_id);
+    }
+
+    size_t GetSize() const;
+    bool IsEmpty() const;
+    bool IsBitset() const;
+    int GetFirst() const;
+    int GetLast() const;
+
+private:
+    int first_ = 0;
+    int last_ = -1;
+    size_t size_ = 0;
+    std::vector<uint64_t> bits_;
+    std::vector<int> sparse_ids_;
+};
+
+// Term frequency of a word by document id
+using PostingList = std::pmr::map<int, StoredFrequency>;
+
+// Posting of a word ordered by its contribution to relevance. The inverse document frequency is the
+// same for every document of a word, so the term frequency alone gives the order
+struct ImpactPosting {
+    StoredFrequency term_freq;
+    int document_id;
+    int rating;
+    DocumentStatus status;
+};
+
+// By status, then by decreasing term frequency. The postings of one status are a contiguous range,
+// so the best documents of every status are at the front of their range. Can be searched by status
+struct ImpactOrder {
+    using is_transparent = void;
+
+    bool operator()(const ImpactPosting& lhs, const ImpactPosting& rhs) const {
+        if (lhs.status != rhs.status) {
+            return lhs.status < rhs.status;
+        }
+        if (lhs.term_freq != rhs.term_freq) {
+            return lhs.term_freq > rhs.term_freq;
+        }
+        return lhs.document_id < rhs.document_id;
+    }
+    bool operator()(const ImpactPosting& lhs, DocumentStatus rhs) const {
+        return lhs.status < rhs;
+    }
+    bool operator()(DocumentStatus lhs, const ImpactPosting& rhs) const {
+        return lhs < rhs.status;
+    }
+};
+
+using ImpactPostingList = std::pmr::set<ImpactPosting, ImpactOrder>;
+
+// A query word resolved against the index. word and postings point into the index
+struct PlannedTerm {
+    std::string_view word;
+    const PostingList* postings = nullptr;
+    // Only when the index keeps impact-ordered postings
+    const ImpactPostingList* impact_postings = nullptr;
+    double inverse_document_freq = 0.0;
+};
+
+// Execution plan of a query. It references the index, so it is valid only until the next AddDocument or RemoveDocument
+struct QueryPlan {
+    // Plus words present in the index and not negated, shortest posting list first
+    std::vector<PlannedTerm> plus_terms;
+    // Minus words present in the index, shortest posting list first
+    std::vector<PlannedTerm> minus_terms;
+    // Plus words that cannot contribute: absent from the index or also given as minus words
+    std::vector<std::string> dropped_words;
+    // Documents of the minus words that any plus term can reach
+    DocumentExclusionSet excluded_documents;
+    // Total length of the plus term posting lists
+    size_t candidate_postings = 0;
+
+    bool CanMatch() const;
+};
+
+// Human-readable description of the plan, one line per term
+std::ostream& operator<<(std::ostream& out, const QueryPlan& plan);
@@ -0,0 +1,132 @@
+#include "query_replay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+const uint64_t kFnvOffset = 14695981039346656037ull;
+const uint64_t kFnvPrime = 1099511628211ull;
+
+void HashInt(uint64_t& hash, int value) {
+    for (int i = 0; i < 4; ++i) {
+        hash = (hash ^ ((static_cast<uint32_t>(value) >> (8 * i)) & 0xFF)) * kFnvPrime;
+    }
+}
+
+// Relevance is left out: the same ranking may be computed with a different rounding
+uint64_t HashResults(const vector<Document>& documents) {
+    uint64_t hash = kFnvOffset;
+    for (const Document& document : documents) {
+        HashInt(hash, document.id);
+        HashInt(hash, document.rating);
+    }
+    return hash;
+}
+
+chrono::nanoseconds Percentile(const vector<chrono::nanoseconds>& sorted_latencies, double share) {
+    if (sorted_latencies.empty()) {
+        return chrono::nanoseconds(0);
+    }
+    const size_t index = min(sorted_latencies.size() - 1, static_cast<size_t>(share * sorted_latencies.size()));
+    return sorted_latencies[index];
+}
+
+string FormatMicroseconds(chrono::nanoseconds duration) {
+    return to_string(chrono::duration_cast<chrono::microseconds>(duration).count()) + " us";
+}
+
+} // namespace
+
+QueryReplayReport ReplayQueryLog(const SearchServer& search_server, const QueryLog& log, const QueryReplayOptions& options) {
+    if (options.thread_count == 0 || options.speedup < 0.0) {
+        throw invalid_argument("Query replay needs a thread and a non-negative speedup");
+    }
+    const auto& records = log.records;
+    QueryReplayReport report;
+    report.skipped_queries = static_cast<size_t>(count_if(records.begin(), records.end(), [](const QueryLogRecord& record) {
+        return !record.status;
+    }));
+    report.query_count = records.size() - report.skipped_queries;
+    report.result_checksums.assign(records.size(), 0);
+    vector<chrono::nanoseconds> latencies(records.size());
+    atomic<size_t> next_record{ 0 };
+    atomic<size_t> failed_queries{ 0 };
+
+    const auto start = chrono::steady_clock::now();
+    const auto replay = [&] {
+        for (size_t i = next_record++; i < records.size(); i = next_record++) {
+            const QueryLogRecord& record = records[i];
+            if (!record.status) {
+                continue;
+            }
+            auto due = chrono::steady_clock::now();
+            if (options.speedup > 0.0) {
+                due = start + chrono::duration_cast<chrono::steady_clock::duration>(record.time / options.speedup);
+                this_thread::sleep_until(due);
+            }
+            try {
+                report.result_checksums[i] = HashResults(search_server.FindTopDocuments(record.raw_query, *record.status));
+            }
+            catch (const exception&) {
+                ++failed_queries;
+            }
+            latencies[i] = chrono::steady_clock::now() - due;
+        }
+    };
+    vector<thread> threads;
+    for (size_t i = 1; i < options.thread_count; ++i) {
+        threads.emplace_back(replay);
+    }
+    replay();
+    for (thread& worker : threads) {
+        worker.join();
+    }
+    report.duration = chrono::steady_clock::now() - start;
+
+    report.failed_queries = failed_queries;
+    if (report.duration.count() > 0) {
+        report.throughput = report.query_count / chrono::duration<double>(report.duration).count();
+    }
+    vector<chrono::nanoseconds> replayed_latencies;
+    replayed_latencies.reserve(report.query_count);
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (records[i].status) {
+            replayed_latencies.push_back(latencies[i]);
+        }
+    }
+    latencies = move(replayed_latencies);
+    sort(latencies.begin(), latencies.end());
+    report.latency_p50 = Percentile(latencies, 0.5);
+    report.latency_p90 = Percentile(latencies, 0.9);
+    report.latency_p99 = Percentile(latencies, 0.99);
+    report.latency_p999 = Percentile(latencies, 0.999);
+    report.latency_max = latencies.empty() ? chrono::nanoseconds(0) : latencies.back();
+    report.checksum = kFnvOffset;
+    for (const uint64_t result_checksum : report.result_checksums) {
+        report.checksum = (report.checksum ^ result_checksum) * kFnvPrime;
+    }
+    return report;
+}
+
+ostream& operator<<(ostream& out, const QueryReplayReport& report) {
+    out << report.query_count << " queries";
+    if (report.failed_queries > 0) {
+        out << " (" << report.failed_queries << " failed)";
+    }
+    if (report.skipped_queries > 0) {
+        out << ", " << report.skipped_queries << " with a custom predicate skipped";
+    }
+    out << " in " << chrono::duration_cast<chrono::milliseconds>(report.duration).count() << " ms, "
+        << static_cast<uint64_t>(report.throughput) << " queries/s" << endl;
+    out << "latency p50 " << FormatMicroseconds(report.latency_p50) << ", p90 " << FormatMicroseconds(report.latency_p90)
+        << ", p99 " << FormatMicroseconds(report.latency_p99) << ", p99.9 " << FormatMicroseconds(report.latency_p999)
+        << ", max " << FormatMicroseconds(report.latency_max) << endl;
+    out << "result checksum " << hex << report.checksum << dec << endl;
+    return out;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "query_log.h"
+#include "search_server.h"
+
+struct QueryReplayOptions {
+    size_t thread_count = 1;
+    // 2 replays the log twice as fast as it was recorded, 0 sends every query as soon as a thread is free
+    double speedup = 1.0;
+};
+
+struct QueryReplayReport {
+    // Queries replayed, skipped ones excluded
+    size_t query_count = 0;
+    // Queries that threw, such as ones with invalid words
+    size_t failed_queries = 0;
+    // Requests recorded with a custom predicate: the log does not hold the filter, so they are not replayed
+    size_t skipped_queries = 0;
+    std::chrono::nanoseconds duration{ 0 };
+    // Queries per second
+    double throughput = 0.0;
+    // From the time a query was due to its results, so the time it waited behind slower queries counts.
+    // Without pacing, from the time a thread took it
+    std::chrono::nanoseconds latency_p50{ 0 };
+    std::chrono::nanoseconds latency_p90{ 0 };
+    std::chrono::nanoseconds latency_p99{ 0 };
+    std::chrono::nanoseconds latency_p999{ 0 };
+    std::chrono::nanoseconds latency_max{ 0 };
+    // Hash of the ids and ratings of the results of every query, in the order of the log, 0 for skipped ones.
+    // Comparing them between two replays finds the queries whose rankings changed
+    std::vector<uint64_t> result_checksums;
+    // Hash of all result checksums
+    uint64_t checksum = 0;
+};
+
+// Plays the log back open-loop: every query is due at its recorded time divided by the speedup, however
+// long the earlier ones take. Up to thread_count queries run at once, a due query waits for a free thread.
+// Requests search by their recorded status; requests recorded with a custom predicate are skipped and counted
+QueryReplayReport ReplayQueryLog(const SearchServer& search_server, const QueryLog& log, const QueryReplayOptions& options = {});
+
+std::ostream& operator<<(std::ostream& out, const QueryReplayReport& report);
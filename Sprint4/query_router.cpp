@@ -0,0 +1,193 @@
+#include "query_router.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "search_server.h"
+
+using namespace std;
+
+QueryRouter::QueryRouter(vector<PartitionEndpoint> partitions, chrono::milliseconds partition_timeout)
+    : partition_timeout_(partition_timeout) {
+    if (partitions.empty()) {
+        throw invalid_argument("Query router needs at least one partition");
+    }
+    for (auto& endpoint : partitions) {
+        partitions_.push_back({ move(endpoint), Socket(), FrameReader() });
+    }
+}
+
+size_t QueryRouter::GetPartitionCount() const {
+    return partitions_.size();
+}
+
+RoutedSearchResult QueryRouter::FindTopDocuments(string_view raw_query, DocumentStatus status) {
+    RoutedSearchResult result;
+
+    auto stats_responses = Exchange(vector<string>(partitions_.size(), EncodeStatsRequest(raw_query)));
+    SearchRequest request{ string(raw_query), status, {} };
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        if (!stats_responses[i]) {
+            continue;
+        }
+        CorpusStatistics statistics;
+        try {
+            statistics = DecodeStatsResponse(*stats_responses[i]);
+        }
+        catch (const runtime_error&) {
+            // A response of the wrong type or with a malformed payload fails the partition as a broken connection does
+            Disconnect(partitions_[i]);
+            stats_responses[i].reset();
+            continue;
+        }
+        request.global_statistics.document_count += statistics.document_count;
+        for (const auto& [word, document_freq] : statistics.document_freqs) {
+            request.global_statistics.document_freqs[word] += document_freq;
+        }
+    }
+
+    // A partition that missed the statistics round is not asked to search: its IDF contribution is unknown
+    const string encoded_request = EncodeSearchRequest(request);
+    vector<string> search_requests(partitions_.size());
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        if (stats_responses[i]) {
+            search_requests[i] = encoded_request;
+        }
+    }
+    const auto search_responses = Exchange(search_requests);
+
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        if (!search_responses[i]) {
+            result.failed_partitions.push_back(i);
+            continue;
+        }
+        vector<Document> documents;
+        try {
+            documents = DecodeSearchResponse(*search_responses[i]);
+        }
+        catch (const runtime_error&) {
+            Disconnect(partitions_[i]);
+            result.failed_partitions.push_back(i);
+            continue;
+        }
+        result.documents.insert(result.documents.end(), documents.begin(), documents.end());
+    }
+
+    // Partitions score with the global IDF but add the terms in their own order, so relevances may differ
+    // in the last bits. Selecting from id order with the server's rule ranks near ties as a single server does
+    sort(result.documents.begin(), result.documents.end(), [](const Document& lhs, const Document& rhs) {
+        return lhs.id < rhs.id;
+    });
+    result.documents = SearchServer::SelectTopDocuments(result.documents);
+    return result;
+}
+
+vector<optional<Message>> QueryRouter::Exchange(const vector<string>& requests) {
+    const auto deadline = chrono::steady_clock::now() + partition_timeout_;
+    vector<optional<Message>> responses(partitions_.size());
+    vector<size_t> pending;
+
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        if (requests[i].empty() || !EnsureConnected(partitions_[i], deadline)) {
+            continue;
+        }
+        if (!SendAll(partitions_[i].socket, requests[i], deadline)) {
+            Disconnect(partitions_[i]);
+            continue;
+        }
+        pending.push_back(i);
+    }
+
+    vector<pollfd> descriptors;
+    string error;
+    char buffer[64 * 1024];
+    try {
+        while (!pending.empty()) {
+            const auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                break;
+            }
+            descriptors.clear();
+            for (size_t i : pending) {
+                descriptors.push_back({ partitions_[i].socket.Get(), POLLIN, 0 });
+            }
+            if (poll(descriptors.data(), descriptors.size(), static_cast<int>(left.count())) < 0 && errno != EINTR) {
+                break;
+            }
+
+            vector<size_t> still_pending;
+            for (size_t k = 0; k < pending.size(); ++k) {
+                Partition& partition = partitions_[pending[k]];
+                if (descriptors[k].revents == 0) {
+                    still_pending.push_back(pending[k]);
+                    continue;
+                }
+                const ssize_t received = recv(partition.socket.Get(), buffer, sizeof(buffer), 0);
+                if (received <= 0) {
+                    if (received < 0 && (errno == EINTR || errno == EAGAIN)) {
+                        still_pending.push_back(pending[k]);
+                    }
+                    else {
+                        Disconnect(partition);
+                    }
+                    continue;
+                }
+                try {
+                    partition.reader.Append(buffer, static_cast<size_t>(received));
+                    auto message = partition.reader.Next();
+                    if (!message) {
+                        still_pending.push_back(pending[k]);
+                        continue;
+                    }
+                    if (message->type == MessageType::ERROR_RESPONSE && error.empty()) {
+                        error = "Partition " + to_string(pending[k]) + ": " + DecodeErrorResponse(*message);
+                    }
+                    responses[pending[k]] = move(message);
+                }
+                catch (const runtime_error&) {
+                    // The stream is out of sync after a malformed frame, the partition fails as on a broken connection
+                    Disconnect(partition);
+                }
+            }
+            pending = move(still_pending);
+        }
+    }
+    catch (...) {
+        for (size_t i : pending) {
+            Disconnect(partitions_[i]);
+        }
+        throw;
+    }
+
+    // A late response would be mistaken for the answer to the next request, so drop the connection
+    for (size_t i : pending) {
+        Disconnect(partitions_[i]);
+    }
+    if (!error.empty()) {
+        throw runtime_error(error);
+    }
+    return responses;
+}
+
+bool QueryRouter::EnsureConnected(Partition& partition, chrono::steady_clock::time_point deadline) {
+    if (partition.socket.IsOpen()) {
+        return true;
+    }
+    try {
+        partition.socket = ConnectTo(partition.endpoint, deadline);
+        partition.reader.Clear();
+        return true;
+    }
+    catch (const runtime_error&) {
+        return false;
+    }
+}
+
+void QueryRouter::Disconnect(Partition& partition) {
+    partition.socket.Close();
+    partition.reader.Clear();
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "local_socket.h"
+#include "partition_protocol.h"
+
+struct RoutedSearchResult {
+    std::vector<Document> documents;
+    // Indexes of partitions that timed out, dropped the connection or sent a malformed response; their documents are missing
+    std::vector<size_t> failed_partitions;
+
+    bool IsComplete() const {
+        return failed_partitions.empty();
+    }
+};
+
+// Fans queries out to partition workers and merges their top documents.
+// A query takes two round trips: the first gathers term statistics so that every
+// partition scores with the global IDF, the second collects per-partition top documents.
+// One router keeps one connection per partition and must not be shared between threads.
+class QueryRouter {
+public:
+    QueryRouter(std::vector<PartitionEndpoint> partitions, std::chrono::milliseconds partition_timeout);
+
+    // Throws std::runtime_error when a partition rejects the query
+    RoutedSearchResult FindTopDocuments(std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL);
+
+    size_t GetPartitionCount() const;
+
+private:
+    struct Partition {
+        PartitionEndpoint endpoint;
+        Socket socket;
+        FrameReader reader;
+    };
+
+    std::vector<Partition> partitions_;
+    std::chrono::milliseconds partition_timeout_;
+
+    // Sends requests[i] to every partition i with a non-empty request and waits for one response from each.
+    // Partitions that miss the deadline, drop the connection or send a malformed frame are disconnected
+    // and get std::nullopt. Every partition still pending when it returns or throws is disconnected
+    std::vector<std::optional<Message>> Exchange(const std::vector<std::string>& requests);
+    bool EnsureConnected(Partition& partition, std::chrono::steady_clock::time_point deadline);
+    void Disconnect(Partition& partition);
+};
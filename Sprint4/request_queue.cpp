@@ -1,12 +1,15 @@
 #include "request_queue.h"
 
-RequestQueue::RequestQueue(const SearchServer& search_server) : search_server_(search_server){
+RequestQueue::RequestQueue(const SearchServer& search_server, QueryLogWriter* query_log)
+    : search_server_(search_server)
+    , query_log_(query_log) {
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status) {
-    return RequestQueue::AddFindRequest(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+    if (query_log_) {
+        query_log_->Write(raw_query, status);
+    }
+    return AddResult(search_server_.FindTopDocuments(raw_query, status));
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
@@ -17,4 +20,24 @@ int RequestQueue::GetNoResultRequests() const {
     return num_empty_;
 }
 
+std::vector<Document> RequestQueue::AddResult(std::vector<Document> result) {
+    if (requests_.size() == 1440u)
+    {
+        if (requests_.back().empty_ == true) {
+            --num_empty_;
+        }
+        requests_.pop_back();
+    }
+    if (result.empty())
+    {
+        requests_.push_front(true);
+        ++num_empty_;
+    }
+    else {
+        requests_.push_front(false);
+    }
+
+    return result;
+}
+
  
\ No newline at end of file
@@ -1,14 +1,17 @@
 #pragma once
 #include <deque>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <vector>
 #include "document.h"
+#include "query_log.h"
 #include "search_server.h"
 
 class RequestQueue {
 public:
-    explicit RequestQueue(const SearchServer& search_server) ;
+    // Every request is also written to the query log, if there is one, before it is searched
+    explicit RequestQueue(const SearchServer& search_server, QueryLogWriter* query_log = nullptr);
     
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
@@ -25,27 +28,17 @@ private:
     std::deque<QueryResult> requests_;
     const static int sec_in_day_ = 1440;
     const SearchServer& search_server_;
+    QueryLogWriter* query_log_;
     int num_empty_ = 0;
+
+    // Counts the request in the window of the last day and passes its result through
+    std::vector<Document> AddResult(std::vector<Document> result);
 };
 
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
-    std::vector<Document> result = search_server_.FindTopDocuments(raw_query, document_predicate);
-    if (requests_.size() == 1440u)
-    {
-        if (requests_.back().empty_ == true) {
-            --num_empty_;
-        }
-        requests_.pop_back();
-    }
-    if (result.empty())
-    {
-        requests_.push_front(true);
-        ++num_empty_;
+    if (query_log_) {
+        query_log_->Write(raw_query, std::nullopt);
     }
-    else {
-        requests_.push_front(false);
-    }
-
-    return result;
+    return AddResult(search_server_.FindTopDocuments(raw_query, document_predicate));
 }
@@ -0,0 +1,265 @@
+#include "score_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SCORE_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SCORE_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SCORE_KERNELS_AVX2 __attribute__((target("avx2")))
+#else
+#define SCORE_KERNELS_AVX2
+#endif
+
+using namespace std;
+
+namespace {
+
+const double kRelevanceEpsilon = 1e-6;
+const double kMaskedScore = -numeric_limits<double>::infinity();
+
+struct Candidate {
+    double score;
+    int rating;
+    size_t index;
+};
+
+// Same order as IsMoreRelevant. Documents it considers equal are ranked by index, so that the
+// result does not depend on which other candidates were offered before them
+bool RanksHigher(const Candidate& lhs, const Candidate& rhs) {
+    if (abs(lhs.score - rhs.score) < kRelevanceEpsilon) {
+        if (lhs.rating != rhs.rating) {
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.index < rhs.index;
+    }
+    return lhs.score > rhs.score;
+}
+
+// Keeps the best top_count candidates in a heap whose front is the worst of them
+class TopScores {
+public:
+    explicit TopScores(size_t top_count) : top_count_(top_count) {
+        heap_.reserve(top_count + 1);
+    }
+
+    // Scores below the threshold cannot enter the heap
+    double GetThreshold() const {
+        if (heap_.size() < top_count_) {
+            return numeric_limits<double>::lowest();
+        }
+        return heap_.front().score - kRelevanceEpsilon;
+    }
+
+    void Offer(double score, int rating, size_t index) {
+        const Candidate candidate{ score, rating, index };
+        if (heap_.size() < top_count_) {
+            heap_.push_back(candidate);
+            push_heap(heap_.begin(), heap_.end(), RanksHigher);
+        }
+        else if (RanksHigher(candidate, heap_.front())) {
+            pop_heap(heap_.begin(), heap_.end(), RanksHigher);
+            heap_.back() = candidate;
+            push_heap(heap_.begin(), heap_.end(), RanksHigher);
+        }
+    }
+
+    vector<size_t> Extract() {
+        sort_heap(heap_.begin(), heap_.end(), RanksHigher);
+        vector<size_t> indexes;
+        indexes.reserve(heap_.size());
+        for (const Candidate& candidate : heap_) {
+            indexes.push_back(candidate.index);
+        }
+        return indexes;
+    }
+
+private:
+    size_t top_count_;
+    vector<Candidate> heap_;
+};
+
+void AccumulateScoresScalar(double* scores, const double* term_freqs, double inverse_document_freq, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        scores[i] += term_freqs[i] * inverse_document_freq;
+    }
+}
+
+void ApplyDocumentMaskScalar(double* scores, const DocumentMask* mask, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (mask[i] != DocumentMask::KEPT) {
+            scores[i] = kMaskedScore;
+        }
+    }
+}
+
+vector<size_t> SelectTopScoresScalar(const double* scores, const int* ratings, size_t count, size_t top_count) {
+    TopScores top(top_count);
+    double threshold = top.GetThreshold();
+    for (size_t i = 0; i < count; ++i) {
+        if (scores[i] >= threshold) {
+            top.Offer(scores[i], ratings[i], i);
+            threshold = top.GetThreshold();
+        }
+    }
+    return top.Extract();
+}
+
+#if defined(SCORE_KERNELS_X86)
+
+SCORE_KERNELS_AVX2 void AccumulateScoresAvx2(double* scores, const double* term_freqs, double inverse_document_freq, size_t count) {
+    const __m256d idf = _mm256_set1_pd(inverse_document_freq);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256d contribution = _mm256_mul_pd(_mm256_loadu_pd(term_freqs + i), idf);
+        _mm256_storeu_pd(scores + i, _mm256_add_pd(_mm256_loadu_pd(scores + i), contribution));
+    }
+    AccumulateScoresScalar(scores + i, term_freqs + i, inverse_document_freq, count - i);
+}
+
+SCORE_KERNELS_AVX2 void ApplyDocumentMaskAvx2(double* scores, const DocumentMask* mask, size_t count) {
+    const __m256i kept = _mm256_set1_epi64x(static_cast<int64_t>(DocumentMask::KEPT));
+    const __m256d masked = _mm256_set1_pd(kMaskedScore);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32_t mask_bytes;
+        memcpy(&mask_bytes, mask + i, sizeof(mask_bytes));
+        const __m256i lanes = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(mask_bytes));
+        const __m256d keep = _mm256_castsi256_pd(_mm256_cmpeq_epi64(lanes, kept));
+        _mm256_storeu_pd(scores + i, _mm256_blendv_pd(masked, _mm256_loadu_pd(scores + i), keep));
+    }
+    ApplyDocumentMaskScalar(scores + i, mask + i, count - i);
+}
+
+// Whole blocks of four scores below the current threshold are skipped with one comparison
+SCORE_KERNELS_AVX2 vector<size_t> SelectTopScoresAvx2(const double* scores, const int* ratings, size_t count, size_t top_count) {
+    TopScores top(top_count);
+    double threshold = top.GetThreshold();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256d block = _mm256_loadu_pd(scores + i);
+        const int candidates = _mm256_movemask_pd(_mm256_cmp_pd(block, _mm256_set1_pd(threshold), _CMP_GE_OQ));
+        if (candidates == 0) {
+            continue;
+        }
+        for (size_t lane = 0; lane < 4; ++lane) {
+            const size_t index = i + lane;
+            if ((candidates & (1 << lane)) && scores[index] >= threshold) {
+                top.Offer(scores[index], ratings[index], index);
+                threshold = top.GetThreshold();
+            }
+        }
+    }
+    for (; i < count; ++i) {
+        if (scores[i] >= threshold) {
+            top.Offer(scores[i], ratings[i], i);
+            threshold = top.GetThreshold();
+        }
+    }
+    return top.Extract();
+}
+
+bool DetectAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5));
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+bool DetectAvx2() {
+    return false;
+}
+
+#endif
+
+struct Kernels {
+    void (*accumulate_scores)(double*, const double*, double, size_t);
+    void (*apply_document_mask)(double*, const DocumentMask*, size_t);
+    vector<size_t> (*select_top_scores)(const double*, const int*, size_t, size_t);
+    bool avx2;
+};
+
+const Kernels kScalarKernels{ AccumulateScoresScalar, ApplyDocumentMaskScalar, SelectTopScoresScalar, false };
+
+const Kernels& GetKernels() {
+    static const Kernels kernels = [] {
+#if defined(SCORE_KERNELS_X86)
+        if (DetectAvx2()) {
+            return Kernels{ AccumulateScoresAvx2, ApplyDocumentMaskAvx2, SelectTopScoresAvx2, true };
+        }
+#endif
+        return kScalarKernels;
+    }();
+    return kernels;
+}
+
+const Kernels& GetKernels(KernelSet kernel_set) {
+    if (kernel_set == KernelSet::SCALAR) {
+        return kScalarKernels;
+    }
+    if (!GetKernels().avx2) {
+        throw invalid_argument("AVX2 kernels are not supported by this CPU");
+    }
+    return GetKernels();
+}
+
+} // namespace
+
+bool HasAvx2Kernels() {
+    return GetKernels().avx2;
+}
+
+KernelSet GetSelectedKernelSet() {
+    return GetKernels().avx2 ? KernelSet::AVX2 : KernelSet::SCALAR;
+}
+
+void AccumulateScores(double* scores, const double* term_freqs, double inverse_document_freq, size_t count) {
+    GetKernels().accumulate_scores(scores, term_freqs, inverse_document_freq, count);
+}
+
+void ApplyDocumentMask(double* scores, const DocumentMask* mask, size_t count) {
+    GetKernels().apply_document_mask(scores, mask, count);
+}
+
+vector<size_t> SelectTopScores(const double* scores, const int* ratings, size_t count, size_t top_count) {
+    if (top_count == 0) {
+        return {};
+    }
+    return GetKernels().select_top_scores(scores, ratings, count, top_count);
+}
+
+void AccumulateScores(KernelSet kernel_set, double* scores, const double* term_freqs, double inverse_document_freq, size_t count) {
+    GetKernels(kernel_set).accumulate_scores(scores, term_freqs, inverse_document_freq, count);
+}
+
+void ApplyDocumentMask(KernelSet kernel_set, double* scores, const DocumentMask* mask, size_t count) {
+    GetKernels(kernel_set).apply_document_mask(scores, mask, count);
+}
+
+vector<size_t> SelectTopScores(KernelSet kernel_set, const double* scores, const int* ratings, size_t count, size_t top_count) {
+    if (top_count == 0) {
+        return {};
+    }
+    return GetKernels(kernel_set).select_top_scores(scores, ratings, count, top_count);
+}
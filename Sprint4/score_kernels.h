@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Scoring kernels over dense arrays indexed by document offset. AVX2 versions are
+// picked at runtime when the CPU supports them, otherwise the scalar ones run.
+// Both produce bit-identical results: the AVX2 code multiplies and adds separately instead of using FMA.
+
+// States of a document in a dense document mask
+enum class DocumentMask : uint8_t {
+    UNSEEN = 0,
+    KEPT = 1,
+    EXCLUDED = 2,
+};
+
+bool HasAvx2Kernels();
+
+enum class KernelSet {
+    SCALAR,
+    AVX2,
+};
+
+// Kernels used by the functions below
+KernelSet GetSelectedKernelSet();
+
+// scores[i] += term_freqs[i] * inverse_document_freq
+void AccumulateScores(double* scores, const double* term_freqs, double inverse_document_freq, size_t count);
+
+// Sets every score whose mask is not KEPT to -infinity, so that top selection skips it
+void ApplyDocumentMask(double* scores, const DocumentMask* mask, size_t count);
+
+// Indexes of the top_count best finite scores, best first, in the order of IsMoreRelevant:
+// scores closer than 1e-6 are ranked by rating, then by index
+std::vector<size_t> SelectTopScores(const double* scores, const int* ratings, size_t count, size_t top_count);
+
+// The kernels of one set, to compare the sets with each other. Throw std::invalid_argument for AVX2
+// when the CPU does not support it
+void AccumulateScores(KernelSet kernel_set, double* scores, const double* term_freqs, double inverse_document_freq, size_t count);
+void ApplyDocumentMask(KernelSet kernel_set, double* scores, const DocumentMask* mask, size_t count);
+std::vector<size_t> SelectTopScores(KernelSet kernel_set, const double* scores, const int* ratings, size_t count, size_t top_count);
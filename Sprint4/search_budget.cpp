@@ -0,0 +1,53 @@
+#include "search_budget.h"
+
+#include <algorithm>
+
+using namespace std;
+
+SearchBudget SearchBudget::Timeout(chrono::steady_clock::duration timeout) {
+    SearchBudget budget;
+    budget.deadline = chrono::steady_clock::now() + timeout;
+    return budget;
+}
+
+SearchBudget SearchBudget::Postings(size_t max_postings) {
+    SearchBudget budget;
+    budget.max_postings = max_postings;
+    return budget;
+}
+
+SearchBudgetTracker::SearchBudgetTracker(const SearchBudget& budget)
+    : budget_(budget) {
+}
+
+size_t SearchBudgetTracker::Claim(size_t postings) {
+    if (is_exhausted_.load(memory_order_relaxed)) {
+        return 0;
+    }
+    if (budget_.deadline && chrono::steady_clock::now() >= *budget_.deadline) {
+        is_exhausted_.store(true, memory_order_relaxed);
+        return 0;
+    }
+    size_t claimed = claimed_.load(memory_order_relaxed);
+    size_t granted = 0;
+    do {
+        granted = min(postings, budget_.max_postings - claimed);
+    } while (!claimed_.compare_exchange_weak(claimed, claimed + granted, memory_order_relaxed));
+    if (granted < postings) {
+        is_exhausted_.store(true, memory_order_relaxed);
+    }
+    return granted;
+}
+
+size_t SearchBudgetTracker::GetClaimed() const {
+    return claimed_.load(memory_order_relaxed);
+}
+
+size_t SearchBudgetTracker::GetRemainingPostings() const {
+    return budget_.max_postings - min(budget_.max_postings, claimed_.load(memory_order_relaxed));
+}
+
+bool SearchBudgetTracker::IsExhausted() const {
+    return is_exhausted_.load(memory_order_relaxed) || claimed_.load(memory_order_relaxed) >= budget_.max_postings
+        || (budget_.deadline && chrono::steady_clock::now() >= *budget_.deadline);
+}
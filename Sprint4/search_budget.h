@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "document.h"
+
+// Scoring loops claim postings from the budget in blocks of this size
+const size_t kSearchBudgetBlockSize = 1024;
+
+// Limit on the work of one search: a deadline, a number of postings to score, or both
+struct SearchBudget {
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    size_t max_postings = std::numeric_limits<size_t>::max();
+
+    static SearchBudget Timeout(std::chrono::steady_clock::duration timeout);
+    static SearchBudget Postings(size_t max_postings);
+};
+
+// Top documents of a search that may have stopped before scoring every posting
+struct SearchResult {
+    // With a partial result, the best documents among the postings scored so far
+    std::vector<Document> documents;
+    bool is_partial = false;
+    size_t evaluated_postings = 0;
+    // Postings of the plus words of the query
+    size_t candidate_postings = 0;
+};
+
+// Budget of one search, shared by its tasks. A deadline is checked before every block,
+// so it is overrun by at most the time one thread takes to score a block
+class SearchBudgetTracker {
+public:
+    explicit SearchBudgetTracker(const SearchBudget& budget);
+
+    // How many of the postings may be scored; fewer than requested once the budget runs out, then 0
+    size_t Claim(size_t postings);
+    size_t GetClaimed() const;
+    // Postings the budget may still grant, the largest size_t without a posting limit
+    size_t GetRemainingPostings() const;
+    // Whether the next Claim would get nothing
+    bool IsExhausted() const;
+
+private:
+    const SearchBudget budget_;
+    std::atomic<size_t> claimed_{ 0 };
+    std::atomic<bool> is_exhausted_{ false };
+};
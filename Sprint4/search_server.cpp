@@ -1,63 +1,425 @@
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
 #include <execution>
 #include <deque>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <sstream>
+#include <unordered_set>
 #include <utility>
 #include "log_duration.h"
 #include "search_server.h"
 
 using namespace std;
 
-void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status, const vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
-        throw invalid_argument("Invalid document_id");
+namespace {
+
+// operator[] of a map with std::pmr::string keys would need a pmr::string to be built for every lookup
+template <typename WordMap>
+typename WordMap::mapped_type& FindOrInsert(WordMap& words, string_view word) {
+    auto it = words.find(word);
+    if (it == words.end()) {
+        it = words.emplace(word, typename WordMap::mapped_type()).first;
+    }
+    return it->second;
+}
+
+// Node of a red-black tree: three links and a color, followed by the value
+template <typename Value>
+size_t TreeNodeBytes() {
+    const size_t header = 4 * sizeof(void*);
+    return header + (sizeof(Value) + alignof(void*) - 1) / alignof(void*) * alignof(void*);
+}
+
+// Bytes of a string that did not fit into its small string buffer
+template <typename String>
+size_t StringHeapBytes(const String& text) {
+    const char* object = reinterpret_cast<const char*>(&text);
+    const bool is_local = text.data() >= object && text.data() < object + sizeof(text);
+    return is_local ? 0 : text.capacity() + 1;
+}
+
+// Same tolerance as IsMoreRelevant
+const double kRelevanceEpsilon = 1e-6;
+
+// Longer queries look up too many posting lists for every document read in impact order
+const size_t kMaxImpactQueryWords = 4;
+// Reading in impact order gives up after this share of the postings and falls back to scoring all of them
+const size_t kImpactReadShare = 8;
+
+// Snapshots use the little-endian layout of the partition protocol, framed by a magic number
+const uint32_t kSnapshotMagic = 0x504E5353;
+const uint32_t kSnapshotVersion = 1;
+
+void WriteU32(ostream& out, uint32_t value) {
+    char bytes[4];
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = static_cast<char>(value >> (8 * i));
     }
-    set<string> words_set;
+    out.write(bytes, 4);
+}
+
+void WriteDouble(ostream& out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    WriteU32(out, static_cast<uint32_t>(bits));
+    WriteU32(out, static_cast<uint32_t>(bits >> 32));
+}
+
+void WriteString(ostream& out, string_view value) {
+    WriteU32(out, static_cast<uint32_t>(value.size()));
+    out.write(value.data(), value.size());
+}
+
+// Reads the start of a snapshot from the stream
+uint32_t ReadU32(istream& in) {
+    char bytes[4];
+    if (!in.read(bytes, 4)) {
+        throw runtime_error("Truncated search server snapshot");
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+    }
+    return value;
+}
+
+// Reads from the whole snapshot in memory; strings point into it
+class SnapshotReader {
+public:
+    explicit SnapshotReader(string_view data) : data_(data) {
+    }
+
+    uint32_t GetU32() {
+        Require(4);
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(static_cast<uint8_t>(data_[i])) << (8 * i);
+        }
+        data_.remove_prefix(4);
+        return value;
+    }
+
+    double GetDouble() {
+        const uint64_t low = GetU32();
+        const uint64_t high = GetU32();
+        const uint64_t bits = low | (high << 32);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    string_view GetString() {
+        const uint32_t size = GetU32();
+        Require(size);
+        const string_view value = data_.substr(0, size);
+        data_.remove_prefix(size);
+        return value;
+    }
+
+private:
+    void Require(size_t size) const {
+        if (data_.size() < size) {
+            throw runtime_error("Truncated search server snapshot");
+        }
+    }
+
+    string_view data_;
+};
+
+} // namespace
+
+size_t MemoryUsageReport::GetTotal() const {
+    return dictionary + postings + impact_postings + term_vectors + metadata + caches + allocator_reserve;
+}
+
+// pmr containers copied with their copy constructor would allocate from the default resource,
+// the allocator-extended ones put the copies and everything nested in them into the new resource
+SearchServer::SearchServer(const SearchServer& other)
+    : stop_words_(other.stop_words_)
+    , posting_order_(other.posting_order_)
+    , index_memory_(make_unique<IndexMemoryResource>(other.index_memory_->GetMode()))
+    , word_to_document_freqs_(other.word_to_document_freqs_, index_memory_->GetPostings())
+    , word_to_impact_postings_(other.word_to_impact_postings_, index_memory_->Get())
+    , doc_to_word_freqs_(other.doc_to_word_freqs_, index_memory_->Get())
+    , documents_(other.documents_, index_memory_->Get())
+    , document_ids_(other.document_ids_)
+    , index_version_(other.index_version_) {
+}
+
+// pmr containers keep the allocator of the source on move, and the resource it points to moves with index_memory_
+SearchServer::SearchServer(SearchServer&& other) noexcept
+    : stop_words_(move(other.stop_words_))
+    , posting_order_(other.posting_order_)
+    , index_memory_(move(other.index_memory_))
+    , word_to_document_freqs_(move(other.word_to_document_freqs_))
+    , word_to_impact_postings_(move(other.word_to_impact_postings_))
+    , doc_to_word_freqs_(move(other.doc_to_word_freqs_))
+    , documents_(move(other.documents_))
+    , document_ids_(move(other.document_ids_))
+    , index_version_(other.index_version_) {
+}
+
+void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status, const vector<int>& ratings) {
+    CheckDocumentId(document_id);
     const auto words = SplitIntoWordsNoStop(document);
 
-    const double inv_word_count = 1.0 / words.size();
+    map<string_view, int> word_counts;
     for (const string& word : words) {
-        doc_to_word_freqs_[document_id][word] += inv_word_count;
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        words_set.insert(word);
+        ++word_counts[word];
+    }
+
+    // Each frequency is rounded to the stored precision once
+    const double inv_word_count = 1.0 / words.size();
+    const int rating = ComputeAverageRating(ratings);
+    auto& word_freqs = doc_to_word_freqs_[document_id];
+    for (const auto [word, count] : word_counts) {
+        const StoredFrequency term_freq = count * inv_word_count;
+        FindOrInsert(word_freqs, word) = term_freq;
+        FindOrInsert(word_to_document_freqs_, word)[document_id] = term_freq;
+        if (posting_order_ == PostingOrder::BY_ID_AND_IMPACT) {
+            FindOrInsert(word_to_impact_postings_, word).insert({ term_freq, document_id, rating, status });
+        }
     }
-    documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status });
+    documents_.emplace(document_id, DocumentData{ rating, status });
 
     document_ids_.insert(document_id);
+    ++index_version_;
+}
+
+void SearchServer::CheckNewDocument(int document_id, std::string_view document) const {
+    CheckDocumentId(document_id);
+    SplitIntoWordsNoStop(document);
+}
+
+void SearchServer::CheckDocumentId(int document_id) const {
+    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+        throw invalid_argument("Invalid document_id");
+    }
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query, int document_id) const {
-    Query query = ParseQuery(raw_query);
+    // One document needs a lookup per minus term, not the whole exclusion set
+    QueryScratchArena scratch(query_scratch_counters_);
+    return MatchDocument(PlanQuery(ParseQuery(raw_query, scratch.Get()), nullptr, false), document_id);
+}
 
-    std::vector<std::string_view> matched_words;
-    for (const std::string& word : query.plus_words) {
-        auto it = doc_to_word_freqs_.at(document_id).find(word);
-        if (it == doc_to_word_freqs_.at(document_id).end()) {
-            continue;
-        }
-        else {
-            matched_words.push_back(it->first);
-        }
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const QueryPlan& plan, int document_id) const {
+    const auto document = documents_.find(document_id);
+    if (document == documents_.end()) {
+        throw out_of_range("Document " + to_string(document_id) + " is not found");
     }
-    for (const std::string& word : query.minus_words) {
-        auto it = doc_to_word_freqs_.at(document_id).find(word);
-        if (it == doc_to_word_freqs_.at(document_id).end()) {
-            continue;
-        }
-        else {
-            matched_words.clear();
-            break;
+    // Same code path as MatchAllDocuments, on a block of one document
+    auto matches = MatchDocumentRange(SortTermsByWord(plan.plus_terms), plan.minus_terms, document, next(document));
+    return { move(matches.front().words), matches.front().status };
+}
+
+vector<DocumentMatch> SearchServer::MatchDocumentRange(const vector<PlannedTerm>& plus_terms, const vector<PlannedTerm>& minus_terms,
+    DocumentIterator first, DocumentIterator last) const {
+    vector<DocumentMatch> matches;
+    for (auto it = first; it != last; ++it) {
+        matches.push_back({ it->first, {}, it->second.status });
+    }
+    if (matches.empty()) {
+        return matches;
+    }
+    const int first_id = matches.front().document_id;
+    const int last_id = matches.back().document_id;
+
+    // Postings and matches are both sorted by id, every posting inside the range has its document among the matches
+    const auto for_each_match = [&matches, first_id, last_id](const PlannedTerm& term, auto action) {
+        size_t index = 0;
+        for (auto posting = term.postings->lower_bound(first_id); posting != term.postings->end() && posting->first <= last_id; ++posting) {
+            while (matches[index].document_id < posting->first) {
+                ++index;
+            }
+            action(index);
         }
+    };
+
+    vector<bool> excluded(matches.size(), false);
+    for (const PlannedTerm& term : minus_terms) {
+        for_each_match(term, [&excluded](size_t index) {
+            excluded[index] = true;
+            });
     }
+    for (const PlannedTerm& term : plus_terms) {
+        for_each_match(term, [&matches, &excluded, &term](size_t index) {
+            if (!excluded[index]) {
+                matches[index].words.push_back(term.word);
+            }
+            });
+    }
+    return matches;
+}
 
-    return { matched_words, documents_.at(document_id).status };
+vector<PlannedTerm> SearchServer::SortTermsByWord(vector<PlannedTerm> terms) {
+    sort(terms.begin(), terms.end(), [](const PlannedTerm& lhs, const PlannedTerm& rhs) {
+        return lhs.word < rhs.word;
+        });
+    return terms;
 }
 
 int SearchServer::GetDocumentCount() const {
     return documents_.size();
 }
 
+bool SearchServer::HasDocument(int document_id) const {
+    return documents_.count(document_id) > 0;
+}
+
+SearchServerMemoryStats SearchServer::GetMemoryStats() const {
+    return { index_memory_->GetMode(), index_memory_->GetStats(), index_memory_->GetUpstreamStats(), query_scratch_counters_.GetStats() };
+}
+
+MemoryUsageReport SearchServer::MemoryUsage() const {
+    MemoryUsageReport report;
+    for (const auto& [word, postings] : word_to_document_freqs_) {
+        report.dictionary += TreeNodeBytes<decltype(word_to_document_freqs_)::value_type>() + StringHeapBytes(word);
+        report.postings += postings.size() * TreeNodeBytes<PostingList::value_type>();
+    }
+    for (const auto& [word, impact_postings] : word_to_impact_postings_) {
+        report.impact_postings += TreeNodeBytes<decltype(word_to_impact_postings_)::value_type>() + StringHeapBytes(word)
+            + impact_postings.size() * TreeNodeBytes<ImpactPosting>();
+    }
+    for (const auto& [document_id, word_freqs] : doc_to_word_freqs_) {
+        report.term_vectors += TreeNodeBytes<decltype(doc_to_word_freqs_)::value_type>();
+        for (const auto& [word, term_freq] : word_freqs) {
+            report.term_vectors += TreeNodeBytes<WordMap<StoredFrequency>::value_type>() + StringHeapBytes(word);
+        }
+    }
+    report.metadata = documents_.size() * TreeNodeBytes<decltype(documents_)::value_type>()
+        + document_ids_.size() * TreeNodeBytes<int>();
+    for (const string& word : stop_words_) {
+        report.metadata += TreeNodeBytes<string>() + StringHeapBytes(word);
+    }
+
+    const auto stats = GetMemoryStats();
+    // Queries do not keep plans or results, only their scratch arenas hold memory while they run
+    report.caches = stats.query_scratch.bytes_in_use;
+    if (stats.index_mode != IndexMemoryMode::HEAP && stats.index_upstream.bytes_in_use > stats.index.bytes_in_use) {
+        report.allocator_reserve = stats.index_upstream.bytes_in_use - stats.index.bytes_in_use;
+    }
+    return report;
+}
+
+double SearchServer::GetRelevanceErrorBound(std::string_view raw_query) const {
+    double inverse_document_freqs = 0.0;
+    for (const PlannedTerm& term : PlanQuery(raw_query).plus_terms) {
+        inverse_document_freqs += term.inverse_document_freq;
+    }
+    return inverse_document_freqs * kMaxFrequencyError;
+}
+
+uint64_t SearchServer::GetIndexVersion() const {
+    return index_version_;
+}
+
+void SearchServer::SaveSnapshot(ostream& out) const {
+    WriteU32(out, kSnapshotMagic);
+    WriteU32(out, kSnapshotVersion);
+    WriteU32(out, static_cast<uint32_t>(stop_words_.size()));
+    for (const string& word : stop_words_) {
+        WriteString(out, word);
+    }
+    WriteU32(out, static_cast<uint32_t>(documents_.size()));
+    for (const auto& [document_id, document_data] : documents_) {
+        WriteU32(out, static_cast<uint32_t>(document_id));
+        WriteU32(out, static_cast<uint32_t>(document_data.rating));
+        WriteU32(out, static_cast<uint32_t>(document_data.status));
+    }
+    // The inverted index rather than the documents, so that loading looks up document ids instead of words
+    WriteU32(out, static_cast<uint32_t>(word_to_document_freqs_.size()));
+    for (const auto& [word, postings] : word_to_document_freqs_) {
+        WriteString(out, word);
+        WriteU32(out, static_cast<uint32_t>(postings.size()));
+        for (const auto& [document_id, term_freq] : postings) {
+            WriteU32(out, static_cast<uint32_t>(document_id));
+            WriteDouble(out, term_freq);
+        }
+    }
+    WriteU32(out, kSnapshotMagic);
+    if (!out) {
+        throw runtime_error("Failed to write search server snapshot");
+    }
+}
+
+void SearchServer::LoadSnapshot(istream& in) {
+    if (!documents_.empty()) {
+        throw invalid_argument("Snapshot can be loaded only into an empty search server");
+    }
+    const string image((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    SnapshotReader reader(image);
+    if (reader.GetU32() != kSnapshotMagic || reader.GetU32() != kSnapshotVersion) {
+        throw runtime_error("Not a search server snapshot");
+    }
+    set<string> stop_words;
+    for (uint32_t i = reader.GetU32(); i > 0; --i) {
+        stop_words.emplace(reader.GetString());
+    }
+    if (stop_words != stop_words_) {
+        throw invalid_argument("Snapshot was taken with different stop words");
+    }
+
+    // Everything is saved in key order, so every insertion goes to the end of its map
+    for (uint32_t i = reader.GetU32(); i > 0; --i) {
+        const int document_id = static_cast<int>(reader.GetU32());
+        const int rating = static_cast<int>(reader.GetU32());
+        const auto status = static_cast<DocumentStatus>(reader.GetU32());
+        if (document_id < 0 || (!documents_.empty() && document_id <= prev(documents_.end())->first)) {
+            throw runtime_error("Corrupt search server snapshot");
+        }
+        documents_.emplace_hint(documents_.end(), document_id, DocumentData{ rating, status });
+        doc_to_word_freqs_.emplace_hint(doc_to_word_freqs_.end(), document_id, WordMap<StoredFrequency>());
+        document_ids_.emplace_hint(document_ids_.end(), document_id);
+    }
+    for (uint32_t i = reader.GetU32(); i > 0; --i) {
+        const string_view word = reader.GetString();
+        auto& postings = word_to_document_freqs_.emplace_hint(word_to_document_freqs_.end(), word, PostingList())->second;
+        for (uint32_t j = reader.GetU32(); j > 0; --j) {
+            const int document_id = static_cast<int>(reader.GetU32());
+            const StoredFrequency term_freq = reader.GetDouble();
+            const auto word_freqs = doc_to_word_freqs_.find(document_id);
+            if (word_freqs == doc_to_word_freqs_.end()) {
+                throw runtime_error("Corrupt search server snapshot");
+            }
+            postings.emplace_hint(postings.end(), document_id, term_freq);
+            word_freqs->second.emplace_hint(word_freqs->second.end(), word, term_freq);
+        }
+    }
+    // Impact order is not saved, it follows from the frequencies
+    if (posting_order_ == PostingOrder::BY_ID_AND_IMPACT) {
+        for (const auto& [word, postings] : word_to_document_freqs_) {
+            auto& impact_postings = word_to_impact_postings_.emplace_hint(word_to_impact_postings_.end(), word, ImpactPostingList())->second;
+            for (const auto& [document_id, term_freq] : postings) {
+                const auto& document_data = documents_.at(document_id);
+                impact_postings.insert({ term_freq, document_id, document_data.rating, document_data.status });
+            }
+        }
+    }
+    if (reader.GetU32() != kSnapshotMagic) {
+        throw runtime_error("Corrupt search server snapshot");
+    }
+    ++index_version_;
+}
+
+vector<string> SearchServer::ReadSnapshotStopWords(istream& in) {
+    if (ReadU32(in) != kSnapshotMagic || ReadU32(in) != kSnapshotVersion) {
+        throw runtime_error("Not a search server snapshot");
+    }
+    vector<string> stop_words(ReadU32(in));
+    for (string& word : stop_words) {
+        word.resize(ReadU32(in));
+        if (!in.read(word.data(), word.size())) {
+            throw runtime_error("Truncated search server snapshot");
+        }
+    }
+    return stop_words;
+}
+
 set<int>::const_iterator SearchServer::begin() const {
     return SearchServer::document_ids_.begin();
 }
@@ -81,12 +443,25 @@ const map<std::string_view, double> SearchServer::GetWordFrequencies(int documen
 
 void SearchServer::RemoveDocument(int document_id) {
     if (document_ids_.find(document_id) != document_ids_.end()) {
-        for (auto word : doc_to_word_freqs_.at(document_id)) {
-            word_to_document_freqs_.erase(word.first);
+        const auto& document_data = documents_.at(document_id);
+        for (const auto& [word, term_freq] : doc_to_word_freqs_.at(document_id)) {
+            auto postings = word_to_document_freqs_.find(word);
+            postings->second.erase(document_id);
+            if (posting_order_ == PostingOrder::BY_ID_AND_IMPACT) {
+                auto impact_postings = word_to_impact_postings_.find(word);
+                impact_postings->second.erase({ term_freq, document_id, document_data.rating, document_data.status });
+                if (impact_postings->second.empty()) {
+                    word_to_impact_postings_.erase(impact_postings);
+                }
+            }
+            if (postings->second.empty()) {
+                word_to_document_freqs_.erase(postings);
+            }
         }
         doc_to_word_freqs_.erase(document_id);
         documents_.erase(document_id);
         document_ids_.erase(document_id);
+        ++index_version_;
     }
 }
 
@@ -144,21 +519,276 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(const string& text) const {
     return { word, is_minus, IsStopWord(word) };
 }
 // Existence required
-double SearchServer::ComputeWordInverseDocumentFreq(const string& word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+double SearchServer::ComputeWordInverseDocumentFreq(string_view word) const {
+    const auto postings = word_to_document_freqs_.find(word);
+    if (postings == word_to_document_freqs_.end()) {
+        throw out_of_range("Word " + string(word) + " is not in the index");
+    }
+    return log(GetDocumentCount() * 1.0 / postings->second.size());
+}
+
+double SearchServer::ComputeWordInverseDocumentFreq(string_view word, const CorpusStatistics& statistics) {
+    const auto document_freq = statistics.document_freqs.find(word);
+    if (document_freq == statistics.document_freqs.end()) {
+        throw out_of_range("Word " + string(word) + " is not in the corpus statistics");
+    }
+    return log(statistics.document_count * 1.0 / document_freq->second);
+}
+
+CorpusStatistics SearchServer::GetQueryStatistics(std::string_view raw_query) const {
+    CorpusStatistics statistics;
+    statistics.document_count = GetDocumentCount();
+    for (const auto& word : ParseQuery(raw_query).plus_words) {
+        const auto it = word_to_document_freqs_.find(word);
+        statistics.document_freqs[string(word)] = it == word_to_document_freqs_.end() ? 0 : static_cast<int>(it->second.size());
+    }
+    return statistics;
+}
+
+QueryPlan SearchServer::PlanQuery(std::string_view raw_query) const {
+    return PlanQuery(ParseQuery(raw_query), nullptr);
+}
+
+string SearchServer::ExplainQuery(std::string_view raw_query) const {
+    ostringstream out;
+    out << PlanQuery(raw_query);
+    return out.str();
+}
+
+QueryPlan SearchServer::PlanQuery(const Query& query, const CorpusStatistics* global_statistics, bool collect_exclusions) const {
+    QueryPlan plan;
+    for (const auto& word : query.plus_words) {
+        const auto postings = word_to_document_freqs_.find(word);
+        // Every document of a word that is also a minus word is excluded, so the word scores nothing
+        if (postings == word_to_document_freqs_.end() || postings->second.empty() || query.minus_words.count(word) > 0) {
+            plan.dropped_words.emplace_back(word);
+            continue;
+        }
+        const double inverse_document_freq = global_statistics
+            ? ComputeWordInverseDocumentFreq(word, *global_statistics)
+            : ComputeWordInverseDocumentFreq(word);
+        const ImpactPostingList* impact_postings = nullptr;
+        if (posting_order_ == PostingOrder::BY_ID_AND_IMPACT) {
+            impact_postings = &word_to_impact_postings_.find(word)->second;
+        }
+        plan.plus_terms.push_back({ postings->first, &postings->second, impact_postings, inverse_document_freq });
+        plan.candidate_postings += postings->second.size();
+    }
+    for (const auto& word : query.minus_words) {
+        const auto postings = word_to_document_freqs_.find(word);
+        if (postings != word_to_document_freqs_.end() && !postings->second.empty()) {
+            plan.minus_terms.push_back({ postings->first, &postings->second, nullptr, 0.0 });
+        }
+    }
+
+    const auto shorter_postings = [](const PlannedTerm& lhs, const PlannedTerm& rhs) {
+        return lhs.postings->size() < rhs.postings->size();
+    };
+    stable_sort(plan.plus_terms.begin(), plan.plus_terms.end(), shorter_postings);
+    stable_sort(plan.minus_terms.begin(), plan.minus_terms.end(), shorter_postings);
+
+    if (!collect_exclusions || !plan.CanMatch() || plan.minus_terms.empty()) {
+        return plan;
+    }
+    // Only minus documents inside the id range of the plus postings can ever be looked up
+    int first = numeric_limits<int>::max();
+    int last = numeric_limits<int>::min();
+    for (const PlannedTerm& term : plan.plus_terms) {
+        first = min(first, term.postings->begin()->first);
+        last = max(last, term.postings->rbegin()->first);
+    }
+    vector<int> excluded_ids;
+    for (const PlannedTerm& term : plan.minus_terms) {
+        for (auto it = term.postings->lower_bound(first); it != term.postings->end() && it->first <= last; ++it) {
+            excluded_ids.push_back(it->first);
+        }
+    }
+    plan.excluded_documents = DocumentExclusionSet(move(excluded_ids));
+    return plan;
+}
+
+QueryCost SearchServer::EstimateQueryCost(const QueryPlan& plan) const {
+    QueryCost cost;
+    cost.plus_words = plan.plus_terms.size();
+    cost.minus_words = plan.minus_terms.size();
+    // Minus postings are consumed while planning, only the plus postings are left for execution
+    cost.postings = plan.candidate_postings;
+    return cost;
+}
+
+SearchServer::PostingSplitter::PostingSplitter(const vector<PlannedTerm>& terms, size_t grain_size)
+    : terms_(terms)
+    , grain_size_(grain_size) {
+    if (!terms_.empty()) {
+        position_ = terms_.front().postings->begin();
+    }
+}
+
+vector<SearchServer::PostingChunk> SearchServer::PostingSplitter::Next(size_t chunk_count, const SearchBudgetTracker& budget) {
+    vector<PostingChunk> chunks;
+    const size_t max_postings = budget.GetRemainingPostings();
+    size_t postings = 0;
+    while (chunks.size() < chunk_count && term_index_ < terms_.size() && postings < max_postings && !budget.IsExhausted()) {
+        const PlannedTerm& term = terms_[term_index_];
+        const auto chunk_begin = position_;
+        size_t chunk_size = 0;
+        // A list that fits into one chunk is handed out without walking it
+        if (position_ == term.postings->begin() && term.postings->size() <= grain_size_) {
+            chunk_size = term.postings->size();
+            position_ = term.postings->end();
+        }
+        for (; chunk_size < grain_size_ && position_ != term.postings->end(); ++chunk_size) {
+            ++position_;
+        }
+        if (chunk_size > 0) {
+            chunks.push_back({ chunk_begin, chunk_size, term.inverse_document_freq });
+            postings += chunk_size;
+        }
+        if (position_ == term.postings->end() && ++term_index_ < terms_.size()) {
+            position_ = terms_[term_index_].postings->begin();
+        }
+    }
+    return chunks;
+}
+
+optional<SearchServer::DocumentRange> SearchServer::FindDenseDocumentRange(const QueryPlan& plan) {
+    // Dense arrays cost time proportional to the id range, scoring costs time proportional to the postings
+    const size_t kMaxRangePerPosting = 4;
+    const size_t kMaxRange = 1 << 24;
+
+    optional<DocumentRange> range;
+    for (const PlannedTerm& term : plan.plus_terms) {
+        const int first = term.postings->begin()->first;
+        const int last = term.postings->rbegin()->first;
+        range = range ? DocumentRange{ min(range->first, first), max(range->last, last) } : DocumentRange{ first, last };
+    }
+    if (!range) {
+        return nullopt;
+    }
+    const size_t span = static_cast<size_t>(range->last - range->first) + 1;
+    if (span > kMaxRange || span > plan.candidate_postings * kMaxRangePerPosting) {
+        return nullopt;
+    }
+    return range;
+}
+
+vector<Document> SearchServer::SelectTopDocuments(const vector<Document>& matched_documents) {
+    vector<double> relevances;
+    vector<int> ratings;
+    relevances.reserve(matched_documents.size());
+    ratings.reserve(matched_documents.size());
+    for (const Document& document : matched_documents) {
+        relevances.push_back(document.relevance);
+        ratings.push_back(document.rating);
+    }
+
+    vector<Document> top_documents;
+    for (const size_t index : SelectTopScores(relevances.data(), ratings.data(), matched_documents.size(), kMaxResultDocumentCount)) {
+        top_documents.push_back(matched_documents[index]);
+    }
+    return top_documents;
 }
 
-SearchServer::Query SearchServer::ParseQuery(std::string_view text) const {
-    SearchServer::Query result;
+optional<vector<Document>> SearchServer::FindTopDocumentsByImpact(string_view raw_query, DocumentStatus status) const {
+    if (posting_order_ != PostingOrder::BY_ID_AND_IMPACT) {
+        return nullopt;
+    }
+    QueryScratchArena scratch(query_scratch_counters_);
+    // Minus words are checked per document read, a few lookups instead of all their postings
+    const auto plan = PlanQuery(ParseQuery(raw_query, scratch.Get()), nullptr, false);
+    if (!plan.CanMatch()) {
+        return vector<Document>();
+    }
+    if (plan.plus_terms.size() > kMaxImpactQueryWords) {
+        return nullopt;
+    }
+
+    struct Cursor {
+        ImpactPostingList::const_iterator position;
+        ImpactPostingList::const_iterator end;
+    };
+    vector<Cursor> cursors;
+    for (const PlannedTerm& term : plan.plus_terms) {
+        // Not equal_range: with a transparent comparator libstdc++ walks the range to find its end
+        cursors.push_back({ term.impact_postings->lower_bound(status), term.impact_postings->upper_bound(status) });
+    }
+    const bool is_single_word = cursors.size() == 1;
+    const size_t max_reads = plan.candidate_postings / kImpactReadShare;
+
+    // Score-at-a-time: the next posting comes from the word whose next posting contributes the most.
+    // An unread document can score at most the sum of the next contributions of all words
+    pmr::unordered_set<int> read_documents(scratch.Get());
+    pmr::vector<Document> matched_documents(scratch.Get());
+    priority_queue<double, pmr::vector<double>, greater<double>> top_relevances(greater<double>(), pmr::vector<double>(scratch.Get()));
+    for (size_t reads = 0;; ++reads) {
+        double max_unread_relevance = 0.0;
+        double max_contribution = -1.0;
+        size_t next_word = 0;
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            if (cursors[i].position == cursors[i].end) {
+                continue;
+            }
+            const double contribution = cursors[i].position->term_freq * plan.plus_terms[i].inverse_document_freq;
+            max_unread_relevance += contribution;
+            if (contribution > max_contribution) {
+                max_contribution = contribution;
+                next_word = i;
+            }
+        }
+        // Every unread document ranks below the top ones, documents within the tie tolerance of them included
+        if (max_contribution < 0.0 || (top_relevances.size() == static_cast<size_t>(kMaxResultDocumentCount)
+            && max_unread_relevance < top_relevances.top() - kRelevanceEpsilon)) {
+            break;
+        }
+        if (!is_single_word && reads == max_reads) {
+            return nullopt;
+        }
+
+        const ImpactPosting& posting = *cursors[next_word].position++;
+        if (!is_single_word && !read_documents.insert(posting.document_id).second) {
+            continue;
+        }
+        if (any_of(plan.minus_terms.begin(), plan.minus_terms.end(), [&posting](const PlannedTerm& term) {
+            return term.postings->count(posting.document_id) > 0;
+            })) {
+            continue;
+        }
+        // Summed in the order of the plan, as in FindAllDocuments, so that the relevance is the same to the bit
+        double relevance = 0.0;
+        for (size_t i = 0; i < plan.plus_terms.size(); ++i) {
+            const PlannedTerm& term = plan.plus_terms[i];
+            if (i == next_word) {
+                relevance += posting.term_freq * term.inverse_document_freq;
+            }
+            else if (const auto it = term.postings->find(posting.document_id); it != term.postings->end()) {
+                relevance += it->second * term.inverse_document_freq;
+            }
+        }
+        matched_documents.push_back({ posting.document_id, relevance, posting.rating });
+        top_relevances.push(relevance);
+        if (top_relevances.size() > static_cast<size_t>(kMaxResultDocumentCount)) {
+            top_relevances.pop();
+        }
+    }
+
+    // Ties are broken as by the other paths, which offer the documents in id order
+    sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
+        return lhs.id < rhs.id;
+        });
+    return SelectTopDocuments(vector<Document>(matched_documents.begin(), matched_documents.end()));
+}
+
+SearchServer::Query SearchServer::ParseQuery(std::string_view text, pmr::memory_resource* resource) const {
+    SearchServer::Query result(resource);
 
     for (const auto& word : SplitIntoWords(text)) {
         const auto query_word = ParseQueryWord(std::string(word));
         if (!query_word.is_stop) {
             if (query_word.is_minus) {
-                result.minus_words.insert(query_word.data);
+                result.minus_words.emplace(query_word.data);
             }
             else {
-                result.plus_words.insert(query_word.data);
+                result.plus_words.emplace(query_word.data);
             }
         }
     }
@@ -185,6 +815,34 @@ std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query)
     return SearchServer::FindTopDocuments(std::execution::seq, raw_query);
 }
 
+SearchResult SearchServer::FindTopDocuments(std::string_view raw_query, const SearchBudget& budget) const {
+    return SearchServer::FindTopDocuments(std::execution::seq, raw_query, budget);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status, const CorpusStatistics& global_statistics) const {
+    QueryScratchArena scratch(query_scratch_counters_);
+    const auto plan = PlanQuery(ParseQuery(raw_query, scratch.Get()), &global_statistics);
+    if (!plan.CanMatch()) {
+        return {};
+    }
+    SearchBudgetTracker budget(SearchBudget{});
+    return FindTopDocuments(std::execution::seq, plan, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        }, scratch.Get(), budget);
+}
+
+std::vector<Document> SearchServer::FindMatchedDocuments(std::string_view raw_query, DocumentStatus status) const {
+    QueryScratchArena scratch(query_scratch_counters_);
+    const auto plan = PlanQuery(ParseQuery(raw_query, scratch.Get()), nullptr);
+    if (!plan.CanMatch()) {
+        return {};
+    }
+    SearchBudgetTracker budget(SearchBudget{});
+    return FindAllDocuments(std::execution::seq, plan, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        }, scratch.Get(), budget);
+}
+
 void FindTopDocuments(const SearchServer& search_server, const std::string& raw_query) {
     std::cout << "Search Results: " << raw_query << std::endl;
     try {
@@ -202,10 +860,9 @@ void MatchDocuments(const SearchServer& search_server, std::string_view query) {
     try {
         std::cout << "Matching documents to query: " << query << std::endl;
 
-        for (int document_id : search_server) {
-            const auto [words, status] = search_server.MatchDocument(std::execution::seq,query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
-        }
+        search_server.MatchAllDocuments(std::execution::seq, query, [](const DocumentMatch& match) {
+            PrintMatchDocumentResult(match.document_id, match.words, match.status);
+            });
     }
 
     catch (const std::exception& e) {
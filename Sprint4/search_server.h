@@ -1,28 +1,105 @@
 #pragma once
 #include <algorithm>
+#include <cstdint>
 #include<execution>
+#include <iostream>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <set>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
-#include "concurrent_map.h"
+#include "adaptive_execution.h"
+#include "concurrent_hash_map.h"
+#include "memory_resources.h"
+#include "work_stealing_executor.h"
 #include "string_processing.h"
 #include "document.h"
+#include "query_plan.h"
+#include "score_kernels.h"
+#include "search_budget.h"
 
 
 const int kMaxResultDocumentCount = 5;
 
+enum class PostingOrder {
+    // Postings of every word are kept by document id
+    BY_ID,
+    // Postings are also kept by impact, see ImpactPostingList. Single-word queries that filter by status
+    // then read about kMaxResultDocumentCount postings, short queries stop once no unread posting can
+    // reach the top. Every posting is stored twice
+    BY_ID_AND_IMPACT,
+};
+
+// Corpus-wide term statistics, used to score one partition of a larger corpus with global IDF
+struct CorpusStatistics {
+    int document_count = 0;
+    std::map<std::string, int, std::less<>> document_freqs;
+};
+
+// Words of a query found in one document, in alphabetical order. Empty if the document has a minus word
+struct DocumentMatch {
+    int document_id = 0;
+    std::vector<std::string_view> words;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+};
+
+struct SearchServerMemoryStats {
+    IndexMemoryMode index_mode = IndexMemoryMode::HEAP;
+    // Requests of the index containers
+    MemoryResourceStats index;
+    // Memory the index resource took from the heap to serve them
+    MemoryResourceStats index_upstream;
+    // Requests served by the scratch arenas of all queries so far
+    MemoryResourceStats query_scratch;
+};
+
+// Estimated bytes held by a search server, by structure
+struct MemoryUsageReport {
+    // Words of the inverted index
+    size_t dictionary = 0;
+    // Entries of the posting lists
+    size_t postings = 0;
+    // Impact-ordered copies of the posting lists and their words, see PostingOrder
+    size_t impact_postings = 0;
+    // Words and frequencies of every document
+    size_t term_vectors = 0;
+    // Ratings, statuses, document ids and stop words
+    size_t metadata = 0;
+    // Scratch memory of the queries running now. Result caches kept next to the server are added by
+    // their owners, see PaginatedSearch::GetCacheMemoryUsage
+    size_t caches = 0;
+    // Memory the pool or the arena of the index holds beyond what its containers use
+    size_t allocator_reserve = 0;
+
+    size_t GetTotal() const;
+};
+
 class SearchServer {
 public:
-    explicit SearchServer(const std::string& stop_words_text)
-        : SearchServer(SplitIntoWords(stop_words_text)) {
+    explicit SearchServer(const std::string& stop_words_text, IndexMemoryMode memory_mode = IndexMemoryMode::HEAP,
+        PostingOrder posting_order = PostingOrder::BY_ID)
+        : SearchServer(SplitIntoWords(stop_words_text), memory_mode, posting_order) {
     }
     template <typename StringContainer>
-    explicit SearchServer(const StringContainer& stop_words);
+    explicit SearchServer(const StringContainer& stop_words, IndexMemoryMode memory_mode = IndexMemoryMode::HEAP,
+        PostingOrder posting_order = PostingOrder::BY_ID);
+    // The copy gets its own index memory resource of the same mode and the same index.
+    // Query scratch statistics start from zero
+    SearchServer(const SearchServer& other);
+    // Takes over the index memory resource, nothing is copied. Query scratch statistics start from zero.
+    // A moved-from server can only be destroyed
+    SearchServer(SearchServer&& other) noexcept;
+    // Stop words and posting order are fixed on construction
+    SearchServer& operator=(const SearchServer&) = delete;
 
     void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    // Throws std::invalid_argument if AddDocument would reject the document. Changes nothing
+    void CheckNewDocument(int document_id, std::string_view document) const;
 
     template <typename DocumentPredicate, typename Execution>
     std::vector<Document> FindTopDocuments(Execution&& policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
@@ -36,12 +113,60 @@ public:
     std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;   
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
 
+    // Stops scoring once the budget runs out. Terms are scored rarest first, so a partial result
+    // already has the contributions of the most selective words
+    template <typename DocumentPredicate, typename Execution>
+    SearchResult FindTopDocuments(Execution&& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+        const SearchBudget& budget) const;
+    template <typename Execution>
+    SearchResult FindTopDocuments(Execution&& policy, std::string_view raw_query, const SearchBudget& budget) const;
+    SearchResult FindTopDocuments(std::string_view raw_query, const SearchBudget& budget) const;
+
+    // Top kMaxResultDocumentCount of documents sorted by id, ranked as FindTopDocuments ranks them:
+    // relevances closer than 1e-6 are ranked by rating, then by the lower id
+    static std::vector<Document> SelectTopDocuments(const std::vector<Document>& matched_documents);
+
     int GetDocumentCount() const;
+    bool HasDocument(int document_id) const;
+
+    SearchServerMemoryStats GetMemoryStats() const;
+    MemoryUsageReport MemoryUsage() const;
+
+    // Largest possible difference between the relevance of a document computed from the stored
+    // frequencies and from exact ones, see SEARCH_SERVER_FREQUENCY_BITS. Two documents keep their
+    // relative order as long as their exact relevances differ by more than twice the bound
+    double GetRelevanceErrorBound(std::string_view raw_query) const;
+
+    // Changes on every AddDocument and every RemoveDocument that removes something
+    uint64_t GetIndexVersion() const;
+
+    // Binary image of the stop words, documents and stored term frequencies. Loading one needs
+    // an empty server with the same stop words and is faster than adding the documents again
+    void SaveSnapshot(std::ostream& out) const;
+    void LoadSnapshot(std::istream& in);
+    // Stop words of a snapshot, to create the server it is loaded into. Reads only the start of the stream
+    static std::vector<std::string> ReadSnapshotStopWords(std::istream& in);
+
+    // Every document matching the query, in no particular order and without the kMaxResultDocumentCount limit
+    std::vector<Document> FindMatchedDocuments(std::string_view raw_query, DocumentStatus status) const;
+
+    // Local document count and document frequency of every plus word of the query
+    CorpusStatistics GetQueryStatistics(std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status, const CorpusStatistics& global_statistics) const;
+
+    // Execution plan of the query against the current index, and its description
+    QueryPlan PlanQuery(std::string_view raw_query) const;
+    std::string ExplainQuery(std::string_view raw_query) const;
 
     template<typename Execution>
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(Execution&& policy, std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id) const;
 
+    // Matches the query against every document and passes the results to handler in id order,
+    // documents without matched words included. Only the posting lists of the query words are read
+    template <typename Execution, typename Handler>
+    void MatchAllDocuments(Execution&& policy, std::string_view raw_query, Handler handler) const;
+
     std::set<int>::const_iterator begin() const;
     std::set<int>::const_iterator end() const;
 
@@ -57,12 +182,32 @@ private:
         DocumentStatus status;
     };
 
-    const std::set<std::string> stop_words_;
-    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string, double>> doc_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
+    // Compares through string_view, so std::string, std::pmr::string and std::string_view can all look up words
+    struct WordLess {
+        using is_transparent = void;
+
+        bool operator()(std::string_view lhs, std::string_view rhs) const {
+            return lhs < rhs;
+        }
+    };
+
+    template <typename Value>
+    using WordMap = std::pmr::map<std::pmr::string, Value, WordLess>;
+
+    std::set<std::string> stop_words_;
+    const PostingOrder posting_order_;
+    // Declared before the containers that allocate from it, so that it is destroyed after them
+    std::unique_ptr<IndexMemoryResource> index_memory_;
+    WordMap<PostingList> word_to_document_freqs_;
+    // Empty unless the posting order is BY_ID_AND_IMPACT
+    WordMap<ImpactPostingList> word_to_impact_postings_;
+    std::pmr::map<int, WordMap<StoredFrequency>> doc_to_word_freqs_;
+    std::pmr::map<int, DocumentData> documents_;
     std::set<int> document_ids_;
+    uint64_t index_version_ = 0;
+    mutable MemoryCounters query_scratch_counters_;
 
+    void CheckDocumentId(int document_id) const;
     bool IsStopWord(const std::string& word) const;
     static bool IsValidWord(std::string_view word);
     std::vector<std::string> SplitIntoWordsNoStop(std::string_view text) const;
@@ -77,26 +222,99 @@ private:
     QueryWord ParseQueryWord(const std::string& text) const;
 
     struct Query {
-        std::set<std::string, std::less<>> plus_words;
-        std::set<std::string, std::less<>> minus_words;       
+        explicit Query(std::pmr::memory_resource* resource)
+            : plus_words(resource)
+            , minus_words(resource) {
+        }
+
+        std::pmr::set<std::pmr::string, std::less<>> plus_words;
+        std::pmr::set<std::pmr::string, std::less<>> minus_words;
     };
 
-    
-    Query ParseQuery(std::string_view text) const;
+    // The words of the query are allocated from resource, usually the scratch arena of the query
+    Query ParseQuery(std::string_view text, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
 
     // Existence required
-    double ComputeWordInverseDocumentFreq(const std::string& word) const;
+    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    static double ComputeWordInverseDocumentFreq(std::string_view word, const CorpusStatistics& statistics);
+
+    // Minus word postings are collected into the exclusion set only when collect_exclusions is set
+    QueryPlan PlanQuery(const Query& query, const CorpusStatistics* global_statistics, bool collect_exclusions = true) const;
+    QueryCost EstimateQueryCost(const QueryPlan& plan) const;
+
+    struct PostingChunk {
+        PostingList::const_iterator begin;
+        size_t size;
+        double inverse_document_freq;
+    };
+
+    // Cuts the posting lists of the terms into chunks of at most grain_size postings, a few chunks at a time
+    class PostingSplitter {
+    public:
+        PostingSplitter(const std::vector<PlannedTerm>& terms, size_t grain_size);
+
+        // The next chunks, at most chunk_count of them and about as many postings as the budget has left.
+        // Walking the lists takes time too, so the walk stops at the deadline. Empty once every posting is handed out
+        std::vector<PostingChunk> Next(size_t chunk_count, const SearchBudgetTracker& budget);
+
+    private:
+        const std::vector<PlannedTerm>& terms_;
+        size_t grain_size_;
+        size_t term_index_ = 0;
+        PostingList::const_iterator position_;
+    };
+
+    // Claims count postings starting at first from the budget block by block and passes each block to function,
+    // which returns the iterator past the block. Stops at the first block the budget refuses
+    template <typename BlockFunction>
+    static void ForEachPostingBlock(PostingList::const_iterator first, size_t count, SearchBudgetTracker& budget, BlockFunction function);
+
+    template <typename DocumentPredicate, typename Execution>
+    std::vector<Document> FindTopDocuments(Execution&& policy, const QueryPlan& plan, DocumentPredicate document_predicate,
+        std::pmr::memory_resource* scratch, SearchBudgetTracker& budget) const;
+
+    struct DocumentRange {
+        int first;
+        int last;
+    };
+
+    // Id range of the plus word postings if it is small enough to score in dense arrays
+    static std::optional<DocumentRange> FindDenseDocumentRange(const QueryPlan& plan);
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsDense(const DocumentRange& range, const QueryPlan& plan, DocumentPredicate document_predicate,
+        std::pmr::memory_resource* scratch, SearchBudgetTracker& budget) const;
+
+    // Top documents of the status read from the impact-ordered postings, nullopt if the index has none
+    // or the query is too long for them to pay off
+    std::optional<std::vector<Document>> FindTopDocumentsByImpact(std::string_view raw_query, DocumentStatus status) const;
 
-    template <typename K, typename V, typename Execution>
-    std::map<K, V> MaptovecRemove(Execution&& policy, std::map<K, V>& input_map, int document_id);
-    
     template <typename DocumentPredicate,typename Execution>
-    std::vector<Document> FindAllDocuments(Execution&& policy, const Query& query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindAllDocuments(Execution&& policy, const QueryPlan& plan, DocumentPredicate document_predicate,
+        std::pmr::memory_resource* scratch, SearchBudgetTracker& budget) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const QueryPlan& plan, int document_id) const;
+
+    using DocumentIterator = std::pmr::map<int, DocumentData>::const_iterator;
+
+    // Plus terms have to be in alphabetical order. Merges the postings of the terms with the id range of the documents
+    std::vector<DocumentMatch> MatchDocumentRange(const std::vector<PlannedTerm>& plus_terms, const std::vector<PlannedTerm>& minus_terms,
+        DocumentIterator first, DocumentIterator last) const;
+    static std::vector<PlannedTerm> SortTermsByWord(std::vector<PlannedTerm> terms);
+
+    template <typename DocumentRelevances>
+    std::vector<Document> MakeDocuments(const DocumentRelevances& document_to_relevance) const;
 };
 
 template <typename StringContainer>
-SearchServer::SearchServer(const StringContainer& stop_words)
-    : stop_words_(MakeUniqueNonEmptyStrings(stop_words)) {
+SearchServer::SearchServer(const StringContainer& stop_words, IndexMemoryMode memory_mode, PostingOrder posting_order)
+    : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+    , posting_order_(posting_order)
+    , index_memory_(std::make_unique<IndexMemoryResource>(memory_mode))
+    , word_to_document_freqs_(index_memory_->GetPostings())
+    , word_to_impact_postings_(index_memory_->Get())
+    , doc_to_word_freqs_(index_memory_->Get())
+    , documents_(index_memory_->Get()) {
     if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
         throw std::invalid_argument("Some of stop words are invalid");
     }
@@ -104,28 +322,111 @@ SearchServer::SearchServer(const StringContainer& stop_words)
 
 template <typename DocumentPredicate, typename Execution>
 std::vector<Document> SearchServer::FindTopDocuments(Execution&& policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
+    return FindTopDocuments(policy, raw_query, document_predicate, SearchBudget{}).documents;
+}
 
-    const auto query = ParseQuery(raw_query);
+template <typename DocumentPredicate, typename Execution>
+SearchResult SearchServer::FindTopDocuments(Execution&& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+    const SearchBudget& budget) const {
 
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+    QueryScratchArena scratch(query_scratch_counters_);
+    const auto plan = PlanQuery(ParseQuery(raw_query, scratch.Get()), nullptr);
+    if (!plan.CanMatch()) {
+        return {};
+    }
 
-    sort(policy, matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < 1e-6) {
-            return lhs.rating > rhs.rating;
+    SearchBudgetTracker tracker(budget);
+    SearchResult result;
+    if constexpr (std::is_same_v<std::decay_t<Execution>, AdaptiveExecutionPolicy>) {
+        auto& tuner = ExecutionTuner::Instance();
+        switch (tuner.Choose(EstimateQueryCost(plan))) {
+        case ExecutionChoice::PARTITIONED:
+            result.documents = FindTopDocuments(WorkStealingExecutionPolicy{ nullptr, tuner.GetThresholds().grain_size }, plan, document_predicate,
+                scratch.Get(), tracker);
+            break;
+        case ExecutionChoice::PARALLEL:
+            result.documents = FindTopDocuments(search_execution::work_stealing, plan, document_predicate, scratch.Get(), tracker);
+            break;
+        default:
+            result.documents = FindTopDocuments(std::execution::seq, plan, document_predicate, scratch.Get(), tracker);
+            break;
         }
-        else {
-            return lhs.relevance > rhs.relevance;
+    }
+    else {
+        result.documents = FindTopDocuments(policy, plan, document_predicate, scratch.Get(), tracker);
+    }
+    result.candidate_postings = plan.candidate_postings;
+    result.evaluated_postings = tracker.GetClaimed();
+    result.is_partial = result.evaluated_postings < result.candidate_postings;
+    return result;
+}
+
+template <typename DocumentPredicate, typename Execution>
+std::vector<Document> SearchServer::FindTopDocuments(Execution&& policy, const QueryPlan& plan, DocumentPredicate document_predicate,
+    std::pmr::memory_resource* scratch, SearchBudgetTracker& budget) const {
+    // Planning can use up a deadline, and then the empty result needs no score arrays or tables
+    if (budget.IsExhausted()) {
+        return {};
+    }
+    // Dense scoring is single-threaded and vectorized, it replaces the sequential path when candidate ids are close together
+    if constexpr (std::is_same_v<std::decay_t<Execution>, std::execution::sequenced_policy>) {
+        if (const auto range = FindDenseDocumentRange(plan)) {
+            return FindTopDocumentsDense(*range, plan, document_predicate, scratch, budget);
         }
-        });
-    if (matched_documents.size() > kMaxResultDocumentCount) {
-        matched_documents.resize(kMaxResultDocumentCount);
     }
+    return SelectTopDocuments(FindAllDocuments(policy, plan, document_predicate, scratch, budget));
+}
 
-    return matched_documents;
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsDense(const DocumentRange& range, const QueryPlan& plan, DocumentPredicate document_predicate,
+    std::pmr::memory_resource* scratch, SearchBudgetTracker& budget) const {
+    const size_t span = static_cast<size_t>(range.last - range.first) + 1;
+    std::pmr::vector<double> scores(span, 0.0, scratch);
+    std::pmr::vector<double> term_freqs(span, 0.0, scratch);
+    std::pmr::vector<DocumentMask> mask(span, DocumentMask::UNSEEN, scratch);
+    std::pmr::vector<int> ratings(span, 0, scratch);
+
+    for (const PlannedTerm& term : plan.plus_terms) {
+        ForEachPostingBlock(term.postings->begin(), term.postings->size(), budget, [&](PostingList::const_iterator block_begin, size_t block_size) {
+            auto it = block_begin;
+            for (size_t i = 0; i < block_size; ++i, ++it) {
+                const auto [document_id, term_freq] = *it;
+                const size_t offset = static_cast<size_t>(document_id - range.first);
+                term_freqs[offset] = term_freq;
+                if (mask[offset] == DocumentMask::UNSEEN) {
+                    const auto& document_data = documents_.at(document_id);
+                    const bool kept = !plan.excluded_documents.Contains(document_id)
+                        && document_predicate(document_id, document_data.status, document_data.rating);
+                    mask[offset] = kept ? DocumentMask::KEPT : DocumentMask::EXCLUDED;
+                    ratings[offset] = document_data.rating;
+                }
+            }
+
+            // Postings are sorted by id, so the block only touches the span between its first and last document
+            const size_t first = static_cast<size_t>(block_begin->first - range.first);
+            const size_t last = static_cast<size_t>(std::prev(it)->first - range.first);
+            AccumulateScores(scores.data() + first, term_freqs.data() + first, term.inverse_document_freq, last - first + 1);
+            for (auto posting = block_begin; posting != it; ++posting) {
+                term_freqs[static_cast<size_t>(posting->first - range.first)] = 0.0;
+            }
+            return it;
+            });
+    }
+
+    ApplyDocumentMask(scores.data(), mask.data(), span);
+    std::vector<Document> top_documents;
+    for (const size_t offset : SelectTopScores(scores.data(), ratings.data(), span, kMaxResultDocumentCount)) {
+        top_documents.push_back({ range.first + static_cast<int>(offset), scores[offset], ratings[offset] });
+    }
+    return top_documents;
 }
 
 template <typename Execution>
 std::vector<Document> SearchServer::FindTopDocuments(Execution&& policy, std::string_view raw_query, DocumentStatus status) const {
+    // A few postings read in impact order need no parallelism
+    if (auto top_documents = FindTopDocumentsByImpact(raw_query, status)) {
+        return std::move(*top_documents);
+    }
     return SearchServer::FindTopDocuments(policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
         return document_status == status;
         });
@@ -136,6 +437,13 @@ std::vector<Document> SearchServer::FindTopDocuments(Execution&& policy, std::st
     return SearchServer::FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
+template <typename Execution>
+SearchResult SearchServer::FindTopDocuments(Execution&& policy, std::string_view raw_query, const SearchBudget& budget) const {
+    return SearchServer::FindTopDocuments(policy, raw_query, [](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == DocumentStatus::ACTUAL;
+        }, budget);
+}
+
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const {
     return SearchServer::FindTopDocuments(std::execution::seq, raw_query, document_predicate);
@@ -143,75 +451,131 @@ std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
 
 template <typename Execution>
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(Execution&& policy,std::string_view raw_query, int document_id) const {
-    Query query = ParseQuery(raw_query);
-    std::vector<std::string_view> matched_words;
-
-    for_each(query.plus_words.begin(), query.plus_words.end(), [&matched_words, this, document_id] 
-        (auto const& word) {
-
-        auto it = doc_to_word_freqs_.at(document_id).find(word);
-        if (it != doc_to_word_freqs_.at(document_id).end()) {
-            matched_words.push_back(it->first);
-        }   
-        });
-
-    for_each(query.minus_words.begin(), query.minus_words.end(), [&matched_words, this, document_id]
-    (auto const& word) {
-            auto it = doc_to_word_freqs_.at(document_id).find(word);
-            if (it != doc_to_word_freqs_.at(document_id).end()) {
-                matched_words.clear();
-            }
-           });
-
-    return { matched_words, documents_.at(document_id).status };
+    // A single document is checked with a few posting lookups, there is nothing to run in parallel
+    return MatchDocument(raw_query, document_id);
 }
 
-template <typename K, typename V, typename Execution>
-std::map<K, V> MaptovecRemove(Execution&& policy, std::map<K, V>& input_map, int document_id) {
-    std::vector<std::pair<K, V>> output_vec(make_move_iterator(input_map.begin()), make_move_iterator(input_map.end()));
+template <typename Execution, typename Handler>
+void SearchServer::MatchAllDocuments(Execution&& policy, std::string_view raw_query, Handler handler) const {
+    QueryScratchArena scratch(query_scratch_counters_);
+    const auto plan = PlanQuery(ParseQuery(raw_query, scratch.Get()), nullptr, false);
+    const auto plus_terms = SortTermsByWord(plan.plus_terms);
+
+    // A wave of blocks is matched in parallel, then its results are handed out in order,
+    // so memory stays bounded by the wave and not by the whole corpus
+    const size_t kBlockSize = 1024;
+    const size_t kBlocksPerWave = 64;
+    struct DocumentBlock {
+        DocumentIterator first;
+        DocumentIterator last;
+    };
 
-    std::remove_if(policy, output_vec.begin(), output_vec.end(), [document_id](auto doc) {
-        return doc.first == document_id;
-        });
+    for (auto it = documents_.begin(); it != documents_.end();) {
+        std::vector<DocumentBlock> blocks;
+        while (blocks.size() < kBlocksPerWave && it != documents_.end()) {
+            const auto block_first = it;
+            for (size_t i = 0; i < kBlockSize && it != documents_.end(); ++i) {
+                ++it;
+            }
+            blocks.push_back({ block_first, it });
+        }
 
-    std::map<K, V> output_map(make_move_iterator(output_vec.begin()), make_move_iterator(output_vec.end()));
-    return output_map;
+        std::vector<std::vector<DocumentMatch>> matches(blocks.size());
+        Transform(policy, blocks.begin(), blocks.end(), matches.begin(), [this, &plus_terms, &plan](const DocumentBlock& block) {
+            return MatchDocumentRange(plus_terms, plan.minus_terms, block.first, block.last);
+            });
+        for (const auto& block_matches : matches) {
+            for (const DocumentMatch& match : block_matches) {
+                handler(match);
+            }
+        }
+    }
 }
 
 template <typename DocumentPredicate,typename Execution>
-std::vector<Document> SearchServer::FindAllDocuments(Execution&& policy,const Query& query, DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(16);
-
-    for_each(policy, doc_to_word_freqs_.begin(), doc_to_word_freqs_.end(),
-        [this,document_predicate, &query, &document_to_relevance] (const auto& doc) {
-            auto document_id = doc.first;
-            auto word_freq = doc.second;
-
-            const auto& document_data = documents_.at(document_id);
-            for (const std::string& word : query.plus_words) {
-                //check if plus word is contained in the document
-                if (word_freq.find(word) == word_freq.end()) {
-                    continue;
+std::vector<Document> SearchServer::FindAllDocuments(Execution&& policy, const QueryPlan& plan, DocumentPredicate document_predicate,
+    std::pmr::memory_resource* scratch, SearchBudgetTracker& budget) const {
+    using Policy = std::decay_t<Execution>;
+
+    // Minus words were turned into the exclusion set by the planner, excluded documents are never scored
+    if constexpr (std::is_same_v<Policy, std::execution::sequenced_policy>) {
+        std::pmr::map<int, double> document_to_relevance(scratch);
+        for (const PlannedTerm& term : plan.plus_terms) {
+            ForEachPostingBlock(term.postings->begin(), term.postings->size(), budget, [&](PostingList::const_iterator it, size_t block_size) {
+                for (; block_size > 0; --block_size, ++it) {
+                    const auto [document_id, term_freq] = *it;
+                    if (plan.excluded_documents.Contains(document_id)) {
+                        continue;
+                    }
+                    const auto& document_data = documents_.at(document_id);
+                    if (document_predicate(document_id, document_data.status, document_data.rating)) {
+                        document_to_relevance[document_id] += term_freq * term.inverse_document_freq;
+                    }
                 }
-                const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
+                return it;
+                });
+        }
 
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id].ref_to_value += word_freq.at(word) * inverse_document_freq;
+        return MakeDocuments(document_to_relevance);
+    }
+    else {
+        // Every scored document comes from a plus term posting the budget grants, which bounds the table size
+        ConcurrentHashMap<int, double> document_to_relevance(
+            std::min({ plan.candidate_postings, documents_.size(), budget.GetRemainingPostings() }));
+        const auto score_chunk = [this, &plan, document_predicate, &document_to_relevance, &budget](const PostingChunk& chunk) {
+            ForEachPostingBlock(chunk.begin, chunk.size, budget, [&](PostingList::const_iterator it, size_t block_size) {
+                for (; block_size > 0; --block_size, ++it) {
+                    const auto [document_id, term_freq] = *it;
+                    if (plan.excluded_documents.Contains(document_id)) {
+                        continue;
+                    }
+                    const auto& document_data = documents_.at(document_id);
+                    if (document_predicate(document_id, document_data.status, document_data.rating)) {
+                        document_to_relevance.FetchAdd(document_id, term_freq * chunk.inverse_document_freq);
+                    }
                 }
+                return it;
+                });
+        };
+
+        // The postings of all terms are cut into chunks of at most one budget block and scored a wave of chunks at a time
+        const size_t kChunksPerWave = 64;
+        size_t grain_size = kSearchBudgetBlockSize;
+        if constexpr (kIsWorkStealingPolicy<Policy>) {
+            grain_size = std::min(grain_size, AsWorkStealingPolicy(policy).GetGrainSize(plan.candidate_postings));
+        }
+        PostingSplitter splitter(plan.plus_terms, grain_size);
+        for (auto chunks = splitter.Next(kChunksPerWave, budget); !chunks.empty(); chunks = splitter.Next(kChunksPerWave, budget)) {
+            // The pool runs one task per chunk
+            if constexpr (kIsWorkStealingPolicy<Policy>) {
+                ForEach(WorkStealingExecutionPolicy{ &AsWorkStealingPolicy(policy).GetExecutor(), 1 }, chunks.begin(), chunks.end(), score_chunk);
             }
-
-            for (const std::string& word : query.minus_words) {
-                if (word_freq.find(word) == word_freq.end()) {
-                    continue;
-                }
-                document_to_relevance.Erase(document_id);
+            else {
+                std::for_each(policy, chunks.begin(), chunks.end(), score_chunk);
             }
-        });
+        }
 
-    auto document_to_relevance_ord = document_to_relevance.BuildOrdinaryMap();
+        return MakeDocuments(document_to_relevance.BuildSortedVector(policy));
+    }
+}
 
+template <typename BlockFunction>
+void SearchServer::ForEachPostingBlock(PostingList::const_iterator first, size_t count, SearchBudgetTracker& budget, BlockFunction function) {
+    while (count > 0) {
+        const size_t block_size = budget.Claim(std::min(count, kSearchBudgetBlockSize));
+        if (block_size == 0) {
+            return;
+        }
+        first = function(first, block_size);
+        count -= block_size;
+    }
+}
+
+template <typename DocumentRelevances>
+std::vector<Document> SearchServer::MakeDocuments(const DocumentRelevances& document_to_relevance) const {
     std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance_ord) {
+    matched_documents.reserve(document_to_relevance.size());
+    for (const auto& [document_id, relevance] : document_to_relevance) {
         matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
     }
     return matched_documents;
@@ -219,16 +583,46 @@ std::vector<Document> SearchServer::FindAllDocuments(Execution&& policy,const Qu
 
 template <typename Execution>
 void SearchServer::RemoveDocument(Execution&& policy, int document_id) {
-    if (document_ids_.find(document_id) != document_ids_.end()) {
-        std::for_each(policy, word_to_document_freqs_.begin(), word_to_document_freqs_.end(), [document_id](auto& word) {
-            word.second.erase(document_id);
+    const auto document = doc_to_word_freqs_.find(document_id);
+    if (document == doc_to_word_freqs_.end()) {
+        return;
+    }
 
-            });
+    // Each word of the document owns separate posting lists, so they can be updated concurrently
+    struct WordPostings {
+        PostingList* postings;
+        ImpactPostingList* impact_postings;
+        ImpactPosting impact_posting;
+    };
+    const auto& document_data = documents_.at(document_id);
+    std::vector<WordPostings> postings;
+    postings.reserve(document->second.size());
+    for (const auto& [word, term_freq] : document->second) {
+        ImpactPostingList* impact_postings = nullptr;
+        if (posting_order_ == PostingOrder::BY_ID_AND_IMPACT) {
+            impact_postings = &word_to_impact_postings_.find(word)->second;
+        }
+        postings.push_back({ &word_to_document_freqs_.at(word), impact_postings,
+            { term_freq, document_id, document_data.rating, document_data.status } });
+    }
+    ForEach(policy, postings.begin(), postings.end(), [document_id](const WordPostings& word_postings) {
+        word_postings.postings->erase(document_id);
+        if (word_postings.impact_postings) {
+            word_postings.impact_postings->erase(word_postings.impact_posting);
+        }
+        });
 
-        doc_to_word_freqs_ = MaptovecRemove(policy, doc_to_word_freqs_, document_id);
-        documents_ = MaptovecRemove(policy, documents_, document_id);
-        document_ids_.erase(document_id);
+    for (const auto& [word, term_freq] : document->second) {
+        const auto word_postings = word_to_document_freqs_.find(word);
+        if (word_postings->second.empty()) {
+            word_to_document_freqs_.erase(word_postings);
+            word_to_impact_postings_.erase(word);
+        }
     }
+    doc_to_word_freqs_.erase(document);
+    documents_.erase(document_id);
+    document_ids_.erase(document_id);
+    ++index_version_;
 }
 void AddDocument(SearchServer& search_server, int document_id, std::string_view document, DocumentStatus status,
     const std::vector<int>& ratings);
@@ -0,0 +1,44 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Term frequencies are stored in the index with SEARCH_SERVER_FREQUENCY_BITS bits: 64 keeps a double,
+// 32 a float, 16 a fixed-point value. Fewer bits make every posting smaller, at the cost of an error
+// of at most kMaxFrequencyError in every stored frequency
+#ifndef SEARCH_SERVER_FREQUENCY_BITS
+#define SEARCH_SERVER_FREQUENCY_BITS 64
+#endif
+
+// Frequency in [0, 1] stored in units of 1/65535
+class Fixed16Frequency {
+public:
+    Fixed16Frequency() = default;
+
+    Fixed16Frequency(double frequency)
+        : units_(static_cast<uint16_t>(std::lround(std::clamp(frequency, 0.0, 1.0) * kUnits))) {
+    }
+
+    operator double() const {
+        return units_ / kUnits;
+    }
+
+private:
+    static constexpr double kUnits = 65535.0;
+
+    uint16_t units_ = 0;
+};
+
+#if SEARCH_SERVER_FREQUENCY_BITS == 64
+using StoredFrequency = double;
+inline constexpr double kMaxFrequencyError = 0.0;
+#elif SEARCH_SERVER_FREQUENCY_BITS == 32
+using StoredFrequency = float;
+// Half a unit in the last place of a float in [0.5, 1]
+inline constexpr double kMaxFrequencyError = 0x1p-25;
+#elif SEARCH_SERVER_FREQUENCY_BITS == 16
+using StoredFrequency = Fixed16Frequency;
+inline constexpr double kMaxFrequencyError = 0.5 / 65535.0;
+#else
+#error "SEARCH_SERVER_FREQUENCY_BITS must be 64, 32 or 16"
+#endif
@@ -0,0 +1,188 @@
+#include "work_stealing_executor.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+thread_local const WorkStealingExecutor* current_executor = nullptr;
+thread_local size_t current_worker = 0;
+
+void PinCurrentThread(size_t core) {
+#if defined(__linux__)
+    // Core i is the i-th core the process may run on, so pinning works inside a restricted cpuset too
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    core %= static_cast<size_t>(CPU_COUNT(&allowed));
+    int cpu = 0;
+    for (;; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && core-- == 0) {
+            break;
+        }
+    }
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#else
+    (void)core;
+#endif
+}
+
+} // namespace
+
+WorkStealingExecutor::WorkStealingExecutor() : WorkStealingExecutor(Options{}) {
+}
+
+WorkStealingExecutor::WorkStealingExecutor(const Options& options) {
+    size_t thread_count = options.thread_count;
+    if (thread_count == 0) {
+        thread_count = max(1u, thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back(&WorkStealingExecutor::WorkerLoop, this, i, options.pin_threads);
+    }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+    {
+        lock_guard<mutex> guard(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_up_.notify_all();
+    for (auto& worker : threads_) {
+        worker.join();
+    }
+}
+
+WorkStealingExecutor& WorkStealingExecutor::Default() {
+    static WorkStealingExecutor executor;
+    return executor;
+}
+
+size_t WorkStealingExecutor::GetThreadCount() const {
+    return threads_.size();
+}
+
+void WorkStealingExecutor::Submit(function<void()> task) {
+    // Workers push onto their own deque, outside threads spread tasks round-robin
+    size_t index = GetCurrentWorker();
+    if (index == queues_.size()) {
+        index = next_queue_.fetch_add(1, memory_order_relaxed) % queues_.size();
+    }
+    // Counted before the push: a thief may run the task and decrement the counter as soon as it is queued.
+    // A worker that sees the count first merely polls the deques once more
+    queued_tasks_.fetch_add(1);
+    {
+        lock_guard<mutex> guard(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(move(task));
+    }
+    if (sleeping_workers_.load() > 0) {
+        // Taking the lock orders the notification after a worker that is about to sleep checked queued_tasks_
+        { lock_guard<mutex> guard(sleep_mutex_); }
+        wake_up_.notify_one();
+    }
+}
+
+bool WorkStealingExecutor::TryRunPendingTask() {
+    const size_t index = GetCurrentWorker();
+    function<void()> task;
+    if ((index < queues_.size() && PopTask(index, task)) || StealTask(index, task)) {
+        queued_tasks_.fetch_sub(1);
+        task();
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingExecutor::WorkerLoop(size_t index, bool pin_thread) {
+    current_executor = this;
+    current_worker = index;
+    if (pin_thread) {
+        PinCurrentThread(index);
+    }
+
+    while (!stopping_) {
+        if (TryRunPendingTask()) {
+            continue;
+        }
+        unique_lock<mutex> lock(sleep_mutex_);
+        sleeping_workers_.fetch_add(1);
+        wake_up_.wait(lock, [this] {
+            return stopping_ || queued_tasks_.load() > 0;
+            });
+        sleeping_workers_.fetch_sub(1);
+    }
+}
+
+bool WorkStealingExecutor::PopTask(size_t index, function<void()>& task) {
+    auto& queue = *queues_[index];
+    lock_guard<mutex> guard(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingExecutor::StealTask(size_t thief, function<void()>& task) {
+    const size_t queue_count = queues_.size();
+    const size_t start = thief < queue_count ? thief + 1 : next_queue_.load(memory_order_relaxed);
+    for (size_t i = 0; i < queue_count; ++i) {
+        auto& queue = *queues_[(start + i) % queue_count];
+        lock_guard<mutex> guard(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t WorkStealingExecutor::GetCurrentWorker() const {
+    return current_executor == this ? current_worker : queues_.size();
+}
+
+TaskGroup::~TaskGroup() {
+    // Tasks reference the group, it must not go away before they finish
+    while (pending_.load() > 0) {
+        if (!executor_.TryRunPendingTask()) {
+            this_thread::yield();
+        }
+    }
+}
+
+void TaskGroup::Wait() {
+    while (pending_.load() > 0) {
+        if (!executor_.TryRunPendingTask()) {
+            this_thread::yield();
+        }
+    }
+    lock_guard<mutex> guard(exception_mutex_);
+    if (exception_) {
+        rethrow_exception(exchange(exception_, nullptr));
+    }
+}
+
+void TaskGroup::SetException(exception_ptr exception) {
+    lock_guard<mutex> guard(exception_mutex_);
+    if (!exception_) {
+        exception_ = exception;
+    }
+}
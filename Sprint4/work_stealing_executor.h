@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Thread pool with a task deque per worker. A worker pops its own tasks LIFO and steals
+// from the front of the other deques when it runs dry. Threads waiting for a TaskGroup
+// run pending tasks instead of blocking, so fork-join calls may nest freely.
+class WorkStealingExecutor {
+public:
+    struct Options {
+        // 0 means one worker per hardware thread
+        size_t thread_count = 0;
+        // Pins worker i to the i-th core available to the process, wrapping around
+        bool pin_threads = false;
+    };
+
+    WorkStealingExecutor();
+    explicit WorkStealingExecutor(const Options& options);
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+    ~WorkStealingExecutor();
+
+    // Shared pool used by search_execution::work_stealing
+    static WorkStealingExecutor& Default();
+
+    size_t GetThreadCount() const;
+
+    void Submit(std::function<void()> task);
+    // Runs one queued task on the calling thread. Returns false if there was nothing to run
+    bool TryRunPendingTask();
+
+private:
+    struct alignas(64) WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> queued_tasks_{ 0 };
+    std::atomic<size_t> sleeping_workers_{ 0 };
+    std::atomic<size_t> next_queue_{ 0 };
+    std::atomic<bool> stopping_{ false };
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_up_;
+
+    void WorkerLoop(size_t index, bool pin_thread);
+    bool PopTask(size_t index, std::function<void()>& task);
+    bool StealTask(size_t thief, std::function<void()>& task);
+    // Index of the calling worker of this executor, or queues_.size() for outside threads
+    size_t GetCurrentWorker() const;
+};
+
+// Fork-join scope. Wait() helps executing tasks until every task of the group is done
+// and rethrows the first exception thrown by them
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingExecutor& executor) : executor_(executor) {
+    }
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    ~TaskGroup();
+
+    template <typename Function>
+    void Run(Function&& function);
+    void Wait();
+
+private:
+    WorkStealingExecutor& executor_;
+    std::atomic<size_t> pending_{ 0 };
+    std::mutex exception_mutex_;
+    std::exception_ptr exception_;
+
+    void SetException(std::exception_ptr exception);
+};
+
+template <typename Function>
+void TaskGroup::Run(Function&& function) {
+    pending_.fetch_add(1);
+    executor_.Submit([this, function = std::forward<Function>(function)]() mutable {
+        try {
+            function();
+        }
+        catch (...) {
+            SetException(std::current_exception());
+        }
+        pending_.fetch_sub(1);
+        });
+}
+
+// Calls function(begin, end) on subranges of [begin, end) of at most grain_size elements,
+// splitting the range in halves so that idle workers steal the largest pieces
+template <typename Function>
+void ParallelFor(WorkStealingExecutor& executor, size_t begin, size_t end, size_t grain_size, const Function& function) {
+    grain_size = std::max<size_t>(grain_size, 1);
+    TaskGroup group(executor);
+    while (end - begin > grain_size) {
+        const size_t middle = begin + (end - begin) / 2;
+        group.Run([&executor, middle, end, grain_size, &function] {
+            ParallelFor(executor, middle, end, grain_size, function);
+            });
+        end = middle;
+    }
+    if (begin < end) {
+        function(begin, end);
+    }
+    group.Wait();
+}
+
+// Execution policy running the search engine algorithms on a WorkStealingExecutor
+struct WorkStealingExecutionPolicy {
+    // nullptr selects WorkStealingExecutor::Default()
+    WorkStealingExecutor* executor = nullptr;
+    // Elements per task, 0 splits the input into a few tasks per worker
+    size_t grain_size = 0;
+
+    WorkStealingExecutor& GetExecutor() const {
+        return executor ? *executor : WorkStealingExecutor::Default();
+    }
+
+    size_t GetGrainSize(size_t element_count) const {
+        if (grain_size > 0) {
+            return grain_size;
+        }
+        const size_t task_count = GetExecutor().GetThreadCount() * 4;
+        return std::max<size_t>(1, (element_count + task_count - 1) / task_count);
+    }
+};
+
+namespace search_execution {
+inline constexpr WorkStealingExecutionPolicy work_stealing{};
+}
+
+// std::execution::par runs on the default work-stealing pool as well, so that every parallel path of the
+// search engine shares one pool. Other standard policies keep the standard library algorithms
+template <typename ExecutionPolicy>
+inline constexpr bool kIsWorkStealingPolicy = std::is_same_v<std::decay_t<ExecutionPolicy>, WorkStealingExecutionPolicy>
+    || std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::parallel_policy>;
+
+template <typename ExecutionPolicy>
+WorkStealingExecutionPolicy AsWorkStealingPolicy(const ExecutionPolicy& policy) {
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, WorkStealingExecutionPolicy>) {
+        return policy;
+    }
+    else {
+        return {};
+    }
+}
+
+// Algorithms taking either a std::execution policy or WorkStealingExecutionPolicy
+
+template <typename ExecutionPolicy, typename Iterator, typename Function>
+void ForEach(ExecutionPolicy&& policy, Iterator first, Iterator last, Function function) {
+    if constexpr (kIsWorkStealingPolicy<ExecutionPolicy>) {
+        const WorkStealingExecutionPolicy pool_policy = AsWorkStealingPolicy(policy);
+        using Category = typename std::iterator_traits<Iterator>::iterator_category;
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        const size_t grain_size = pool_policy.GetGrainSize(count);
+
+        if constexpr (std::is_base_of_v<std::random_access_iterator_tag, Category>) {
+            ParallelFor(pool_policy.GetExecutor(), 0, count, grain_size, [first, &function](size_t begin, size_t end) {
+                std::for_each(first + begin, first + end, function);
+                });
+        }
+        else {
+            // Chunk boundaries have to be found by walking the sequence once
+            std::vector<Iterator> bounds;
+            for (size_t i = 0; i < count; i += grain_size) {
+                bounds.push_back(first);
+                std::advance(first, std::min(grain_size, count - i));
+            }
+            bounds.push_back(last);
+            ParallelFor(pool_policy.GetExecutor(), 0, bounds.size() - 1, 1, [&bounds, &function](size_t begin, size_t end) {
+                std::for_each(bounds[begin], bounds[end], function);
+                });
+        }
+    }
+    else {
+        std::for_each(std::forward<ExecutionPolicy>(policy), first, last, function);
+    }
+}
+
+template <typename ExecutionPolicy, typename InputIterator, typename OutputIterator, typename Function>
+OutputIterator Transform(ExecutionPolicy&& policy, InputIterator first, InputIterator last, OutputIterator output, Function function) {
+    if constexpr (kIsWorkStealingPolicy<ExecutionPolicy>) {
+        const WorkStealingExecutionPolicy pool_policy = AsWorkStealingPolicy(policy);
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        ParallelFor(pool_policy.GetExecutor(), 0, count, pool_policy.GetGrainSize(count), [first, output, &function](size_t begin, size_t end) {
+            std::transform(first + begin, first + end, output + begin, function);
+            });
+        return output + count;
+    }
+    else {
+        return std::transform(std::forward<ExecutionPolicy>(policy), first, last, output, function);
+    }
+}
+
+// Sorts chunks in parallel, then merges neighbouring runs level by level
+template <typename ExecutionPolicy, typename Iterator, typename Compare>
+void Sort(ExecutionPolicy&& policy, Iterator first, Iterator last, Compare compare) {
+    if constexpr (kIsWorkStealingPolicy<ExecutionPolicy>) {
+        const WorkStealingExecutionPolicy pool_policy = AsWorkStealingPolicy(policy);
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        const size_t run_size = std::max<size_t>(pool_policy.GetGrainSize(count), 1024);
+        if (count <= run_size) {
+            std::sort(first, last, compare);
+            return;
+        }
+        const size_t run_count = (count + run_size - 1) / run_size;
+        auto& executor = pool_policy.GetExecutor();
+        ParallelFor(executor, 0, run_count, 1, [first, count, run_size, &compare](size_t begin, size_t end) {
+            for (size_t run = begin; run < end; ++run) {
+                std::sort(first + run * run_size, first + std::min(count, (run + 1) * run_size), compare);
+            }
+            });
+        for (size_t width = run_size; width < count; width *= 2) {
+            const size_t pair_count = (count + 2 * width - 1) / (2 * width);
+            ParallelFor(executor, 0, pair_count, 1, [first, count, width, &compare](size_t begin, size_t end) {
+                for (size_t pair = begin; pair < end; ++pair) {
+                    const size_t left = pair * 2 * width;
+                    const size_t middle = std::min(count, left + width);
+                    const size_t right = std::min(count, left + 2 * width);
+                    std::inplace_merge(first + left, first + middle, first + right, compare);
+                }
+                });
+        }
+    }
+    else {
+        std::sort(std::forward<ExecutionPolicy>(policy), first, last, compare);
+    }
+}